@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <chrono>
+
+#include "batch.h"
+
+//------------------------------------------------------------------------------------
+// Greedy agent
+//------------------------------------------------------------------------------------
+void
+GreedyAgent::plan (const Tetris& game, const Block& block)
+{
+    const Board& grid = game.getBoard();
+
+    // Only the placements straight below their column are reachable by a hard drop
+    candidates.clear();
+    boards.clear();
+    for (const Placement& p : finder.find(grid, block)) {
+        bool clear = true;
+        for (int y = block.posY; clear && y < p.block.posY; y++)
+            clear = !grid.collides(p.block.mask(), p.block.posX, y);
+        if (!clear)
+            continue;
+
+        candidates.push_back(p.block);
+        boards.push_back(grid);
+        boards.back().place(p.block.mask(), p.block.posX, p.block.posY);
+    }
+
+    scores.resize(boards.size());
+    if (table == nullptr)
+        scoreBoards(boards.data(), static_cast<int>(boards.size()), weights, scores.data());
+    else {
+        for (size_t k = 0; k < boards.size(); k++) {
+            uint64_t key = boards[k].hash();
+            if (!table->probe(key, scores[k])) {
+                scores[k] = scoreFeatures(computeFeatures(boards[k]), weights);
+                table->store(key, scores[k]);
+            }
+        }
+    }
+
+    target = block;
+    if (!scores.empty())
+        target = candidates[std::max_element(scores.begin(), scores.end()) - scores.begin()];
+    pressesLeft = 2 * (4 + game.getCols());
+}
+
+unsigned
+GreedyAgent::act (const Tetris& game)
+{
+    const Block* block = game.getMovingBlock();
+    if (block == nullptr)
+        return previousActions = ACTION_NONE;
+
+    if (game.getPiecesCount() != plannedPiece) {
+        plannedPiece = game.getPiecesCount();
+        plan(game, *block);
+    }
+
+    // Release every other tick, so each move is a new press
+    unsigned actions = ACTION_NONE;
+    if (previousActions == ACTION_NONE) {
+        if (pressesLeft-- <= 0)
+            actions = ACTION_HARD_DROP;
+        else if (block->rotation != target.rotation)
+            actions = ACTION_ROTATE;
+        else if (block->posX != target.posX)
+            actions = block->posX < target.posX ? ACTION_RIGHT : ACTION_LEFT;
+        else
+            actions = ACTION_HARD_DROP;
+    }
+    return previousActions = actions;
+}
+
+//------------------------------------------------------------------------------------
+// Batch runner
+//------------------------------------------------------------------------------------
+BatchReport
+BatchRunner::run (const BatchOptions& options, const AgentFactory& makeAgent)
+{
+    BatchReport report;
+    report.games.resize(options.games);
+
+    // One dataset buffer per worker, flushed when full and at the end of the run
+    std::vector<std::unique_ptr<DatasetWriter::Buffer>> buffers;
+    for (int w = 0; options.dataset != nullptr && w < pool.size(); w++)
+        buffers.emplace_back(new DatasetWriter::Buffer(*options.dataset));
+
+    auto start = std::chrono::steady_clock::now();
+
+    pool.run(options.games, [&] (int index, int worker) {
+        uint32_t seed = options.seed + index;
+        Tetris game(options.config, seed);
+        std::unique_ptr<Agent> agent = makeAgent(seed);
+        DatasetWriter::Buffer* buffer = buffers.empty() ? nullptr : buffers[worker].get();
+
+        while (!game.isGameOver() && game.getTicksCount() < options.maxTicks) {
+            unsigned actions = agent->act(game);
+            if (buffer == nullptr) {
+                game.update(actions);
+                continue;
+            }
+
+            TrajectoryRecord record = TrajectoryRecord::capture(game, actions);
+            int score = game.getScore();
+            game.update(actions);
+            record.reward = game.getScore() - score;
+            record.over = game.isGameOver();
+            buffer->push(record);
+        }
+
+        // Every task writes its own slot, no locking needed
+        report.games[index] = {
+            seed,
+            game.getScore(),
+            game.getLinesCleared(),
+            game.getPiecesCount(),
+            game.getTicksCount()
+        };
+    });
+
+    for (auto& buffer : buffers)
+        buffer->flush();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    report.seconds = elapsed.count();
+    return report;
+}
+
+void
+BatchReport::print (std::ostream& out, bool perGame) const
+{
+    if (perGame) {
+        out << "seed,score,lines,pieces,ticks\n";
+        for (const auto& g : games)
+            out << g.seed << ',' << g.score << ',' << g.lines << ',' << g.pieces << ',' << g.ticks << '\n';
+    }
+
+    if (games.empty()) {
+        out << "games: 0" << std::endl;
+        return;
+    }
+
+    long long score = 0, lines = 0, pieces = 0, ticks = 0;
+    int minScore = games[0].score, maxScore = games[0].score;
+    for (const auto& g : games) {
+        score += g.score; lines += g.lines; pieces += g.pieces; ticks += g.ticks;
+        minScore = std::min(minScore, (int) g.score);
+        maxScore = std::max(maxScore, (int) g.score);
+    }
+
+    double n = games.size();
+    out << "games: " << games.size()
+        << ", score avg/min/max: " << score / n << '/' << minScore << '/' << maxScore
+        << ", lines avg: " << lines / n
+        << ", pieces avg: " << pieces / n
+        << ", ticks: " << ticks
+        << ", time: " << seconds << "s"
+        << ", games/s: " << (seconds > 0 ? n / seconds : 0.0)
+        << ", ticks/s: " << (seconds > 0 ? ticks / seconds : 0.0)
+        << std::endl;
+}
@@ -0,0 +1,118 @@
+#ifndef TETRIS_BATCH_H
+#define TETRIS_BATCH_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "dataset.h"
+#include "evaluation.h"
+#include "placement.h"
+#include "scheduler.h"
+#include "transposition.h"
+#include "tetris.h"
+
+//------------------------------------------------------------------------------------
+// Agents
+//------------------------------------------------------------------------------------
+// A bot playing a game, it picks the actions held for the next tick
+class Agent {
+public:
+    virtual ~Agent () {}
+    virtual unsigned act (const Tetris& game) = 0;
+};
+
+// Creates the agent playing the game with the given seed
+typedef std::function<std::unique_ptr<Agent> (uint32_t seed)> AgentFactory;
+
+// Holds random keys for a few ticks at a time, a baseline for real agents
+class RandomAgent : public Agent {
+private:
+    Random rng;
+    unsigned actions;
+
+public:
+    RandomAgent (uint32_t seed) : rng(seed), actions(ACTION_NONE) {}
+
+    unsigned act (const Tetris& game) override {
+        if (game.getTicksCount() % 10 == 0)
+            actions = rng.next() & (ACTION_LEFT | ACTION_RIGHT | ACTION_ROTATE | ACTION_SOFT_DROP);
+        return actions;
+    }
+};
+
+// Scores every placement of each new block with a linear evaluation of the
+// board features, then rotates, shifts and hard drops the block to the best one.
+// Agents sharing a transposition table only evaluate the boards none of them
+// scored before, like the first placements of every game.
+class GreedyAgent : public Agent {
+private:
+    PlacementFinder finder;
+    FeatureWeights weights;
+    TranspositionTable* table; // Scores of the boards by hash, may be null
+    // Placements reachable by a hard drop, the boards they give and their scores
+    std::vector<Block> candidates;
+    std::vector<Board> boards;
+    std::vector<double> scores;
+    int   plannedPiece; // Pieces count of the game when the target was picked
+    Block target;
+    int   pressesLeft;  // Gives up and drops when the block is stuck
+    unsigned previousActions;
+
+    void plan (const Tetris& game, const Block& block);
+
+public:
+    // The table must outlive the agent and only hold scores of these weights
+    explicit GreedyAgent (const FeatureWeights& w = FeatureWeights::defaults(), TranspositionTable* t = nullptr)
+        : weights(w), table(t), plannedPiece(-1), pressesLeft(0), previousActions(ACTION_NONE) {}
+
+    unsigned act (const Tetris& game) override;
+};
+
+//------------------------------------------------------------------------------------
+// Batch runner
+//------------------------------------------------------------------------------------
+struct GameResult {
+    uint32_t seed;
+    int32_t  score;
+    int32_t  lines;
+    int32_t  pieces;
+    int64_t  ticks;
+};
+
+struct BatchReport {
+    std::vector<GameResult> games;
+    double seconds;
+
+    void print (std::ostream& out, bool perGame = false) const;
+};
+
+struct BatchOptions {
+    int games = 100;
+    uint32_t seed = 1;      // Game i is played with seed + i
+    long maxTicks = 100000; // Games still running after this many ticks are stopped
+    GameConfig config;
+    DatasetWriter* dataset = nullptr; // Gets a record of every tick played when set
+};
+
+//
+// Plays independent games on every core of the machine. Games are the tasks
+// of a work stealing pool, so the cores that get short games (a bot topping
+// out early) take over the games left to the others.
+//
+class BatchRunner {
+private:
+    WorkStealingPool pool;
+
+public:
+    explicit BatchRunner (int threadsCount = 0) : pool(threadsCount) {}
+
+    int threadsCount () const { return pool.size(); }
+    // Throws the first error of the games, like a failed dataset write, once
+    // every thread stopped
+    BatchReport run (const BatchOptions& options, const AgentFactory& makeAgent);
+};
+
+#endif /* TETRIS_BATCH_H */
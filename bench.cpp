@@ -0,0 +1,276 @@
+//
+// Microbenchmarks of the game core. Every benchmark runs on the same seeded
+// boards, so numbers can be compared across commits, and reports the time
+// and the heap allocations per operation.
+//
+// Usage: tetris-bench [filter], only runs the benchmarks whose name contains filter
+//
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "evaluation.h"
+#include "placement.h"
+#include "rollback.h"
+#include "tetris.h"
+#include "transposition.h"
+
+//------------------------------------------------------------------------------------
+// Allocation counting
+//------------------------------------------------------------------------------------
+static std::atomic<long> allocationsCount(0);
+
+// GCC sees through the inlined replacements and wrongly flags free() of new'd memory
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void*
+operator new (std::size_t size)
+{
+    allocationsCount++;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete (void* p) noexcept { std::free(p); }
+void operator delete (void* p, std::size_t) noexcept { std::free(p); }
+
+//------------------------------------------------------------------------------------
+// Constants Definition
+//------------------------------------------------------------------------------------
+static const int boardsCount = 64;
+static const uint32_t benchSeed = 1;
+// Each benchmark runs at least this long
+static const double minSeconds = 0.2;
+
+//------------------------------------------------------------------------------------
+// Utils
+//------------------------------------------------------------------------------------
+// Keeps results alive so the compiler cannot drop the benchmarked code
+static volatile long sink;
+
+static const char* filter = nullptr;
+
+// Runs op(i) for i = 0, 1, ... in doubling batches until minSeconds passed
+template <typename Op>
+static void
+bench (const char* name, Op op)
+{
+    if (filter != nullptr && !std::strstr(name, filter))
+        return;
+
+    long ops = 0, allocations = 0;
+    double seconds = 0;
+    for (long batch = 1024; seconds < minSeconds; batch *= 2) {
+        long allocationsBefore = allocationsCount;
+        auto start = std::chrono::steady_clock::now();
+
+        for (long i = 0; i < batch; i++)
+            op(ops + i);
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        seconds += elapsed.count();
+        allocations += allocationsCount - allocationsBefore;
+        ops += batch;
+    }
+
+    std::printf("%-24s %10.1f ns/op %8.2f allocs/op\n", name, seconds * 1e9 / ops, (double) allocations / ops);
+}
+
+// Boards with a random stack of 0 to 15 rows, every row with at least one hole
+static std::vector<Board>
+makeBoards ()
+{
+    Random rng(benchSeed);
+    std::vector<Board> boards(boardsCount);
+
+    for (Board& board : boards) {
+        board.reset(gridCols, gridRows);
+        int height = rng.below(16);
+        for (int i = gridRows - height; i < gridRows; i++) {
+            int hole = 1 + rng.below(gridCols);
+            for (int j = 1; j <= gridCols; j++) {
+                if (j != hole && rng.below(4) != 0)
+                    board.place(1, j, i); // Single cell shape
+            }
+        }
+        board.clearDirtyRows();
+    }
+    return boards;
+}
+
+// A block of every board, above its stack
+static std::vector<Block>
+makeBlocks ()
+{
+    Random rng(benchSeed + 1);
+    std::vector<Block> blocks(boardsCount);
+
+    for (Block& block : blocks) {
+        block = Block(static_cast<BlockType>(rng.below(BLOCKTYPE_COUNT)));
+        block.rotation = rng.below(4);
+        block.setPosition(1 + rng.below(gridCols - 3), 0);
+    }
+    return blocks;
+}
+
+//------------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------------
+int
+main (int argc, char* argv[])
+{
+    if (argc > 1)
+        filter = argv[1];
+
+    const std::vector<Board> boards = makeBoards();
+    const std::vector<Block> blocks = makeBlocks();
+    const int mask = boardsCount - 1;
+
+    // Boards with full rows to clear, the row of each block filled up
+    std::vector<Board> fullBoards = boards;
+    std::vector<uint32_t> fullRows(boardsCount);
+    for (int b = 0; b < boardsCount; b++) {
+        for (int i = gridRows - 4; i < gridRows; i += 1 + (b & 1)) {
+            for (int j = 1; j <= gridCols; j++)
+                fullBoards[b].place(1, j, i);
+            fullRows[b] |= 1u << i;
+        }
+    }
+
+    std::printf("%d boards of %dx%d, seed %u\n", boardsCount, gridCols, gridRows, benchSeed);
+
+    // Block falling one row: the collision test below it
+    bench("vertical collision", [&] (long i) {
+        const Block& block = blocks[i & mask];
+        sink += boards[i & mask].collides(block.mask(), block.posX, block.posY + 1);
+    });
+
+    bench("rotation collision", [&] (long i) {
+        const Block& block = blocks[i & mask];
+        sink += boards[i & mask].collides(block.rotationPreview(), block.posX, block.posY);
+    });
+
+    // Up to kickTests collision tests when the block is against the stack
+    bench("rotation kicks", [&] (long i) {
+        Block block = blocks[i & mask];
+        sink += rotateBlock(boards[i & mask], block) ? block.posX : 0;
+    });
+
+    bench("drop distance", [&] (long i) {
+        const Block& block = blocks[i & mask];
+        sink += boards[i & mask].dropDistance(block.mask(), block.posX, block.posY);
+    });
+
+    // The width known at compile time, as in the ticks of the standard grid
+    bench("drop distance (10 wide)", [&] (long i) {
+        const Block& block = blocks[i & mask];
+        sink += boards[i & mask].dropDistance<gridCols>(block.mask(), block.posX, block.posY);
+    });
+
+    // The rows a locked block covers
+    bench("check completed rows", [&] (long i) {
+        const Board& board = fullBoards[i & mask];
+        int completed = 0;
+        for (int row = gridRows - 4; row < gridRows; row++)
+            completed += board.isRowFull(row);
+        sink += completed;
+    });
+
+    bench("remove completed rows", [&] (long i) {
+        Board board = fullBoards[i & mask];
+        board.removeRows(fullRows[i & mask]);
+        sink += board.row(gridRows - 1);
+    });
+
+    PieceRandomizer uniform(benchSeed, RANDOMIZER_UNIFORM), bag(benchSeed, RANDOMIZER_BAG);
+    bench("create random block", [&] (long) {
+        Block block(uniform.next());
+        sink += block.mask();
+    });
+    bench("create 7-bag block", [&] (long) {
+        Block block(bag.next());
+        sink += block.mask();
+    });
+
+    // Whole ticks of a game: random keys held a few ticks each, restarting on game over
+    Tetris game(GameConfig(), benchSeed);
+    Random keys(benchSeed);
+    unsigned actions = ACTION_NONE;
+    bench("update tick", [&] (long i) {
+        if (i % 8 == 0)
+            actions = keys.next() & (ACTION_LEFT | ACTION_RIGHT | ACTION_ROTATE | ACTION_SOFT_DROP | ACTION_HARD_DROP);
+        if (game.isGameOver())
+            game.reset(static_cast<uint32_t>(i));
+        game.update(actions);
+        sink += game.getScore();
+    });
+
+    // What draw() reads from the core every frame: every cell with the overlays, and the ghost
+    bench("draw state (cells)", [&] (long) {
+        int filled = 0;
+        for (int row = 0; row < game.getRows() + 1; row++) {
+            for (int col = 0; col < game.getCols() + 2; col++)
+                filled += game.cellState(row, col) != EMPTY;
+        }
+        if (game.getMovingBlock() != nullptr)
+            filled += game.getGhostBlock().posY;
+        sink += filled;
+    });
+
+    const GameState state = game.snapshot();
+    bench("snapshot/restore", [&] (long) {
+        game.restore(state);
+        sink += game.getTicksCount();
+    });
+
+    // A tick of netplay where the remote input always arrives 10 ticks late
+    // and mispredicted, so every tick also plays the last 10 of both games again
+    static RollbackSession session(RollbackOptions(), 0), startSession(RollbackOptions(), 0);
+    bench("rollback 10 ticks", [&] (long i) {
+        if (!session.canAdvance())
+            session = startSession;
+        session.advance(keys.next() & (ACTION_LEFT | ACTION_RIGHT | ACTION_ROTATE));
+        if (session.getTicks() > 10)
+            session.addRemoteActions(session.getRemoteTicks(), (i & 1) ? ACTION_LEFT : ACTION_RIGHT);
+        sink += session.getGame(0).getScore();
+    });
+
+    PlacementFinder finder;
+    bench("find placements", [&] (long i) {
+        sink += finder.find(boards[i & mask], blocks[i & mask]).size();
+    });
+
+    bench("board features", [&] (long i) {
+        sink += computeFeatures(boards[i & mask]).holes;
+    });
+
+    // Per board, the batch a greedy agent scores for every new block
+    std::vector<double> scores(boardsCount);
+    bench("score boards (batch)", [&] (long i) {
+        if ((i & mask) == 0)
+            scoreBoards(boards.data(), boardsCount, FeatureWeights::defaults(), scores.data());
+        sink += static_cast<long>(scores[i & mask]);
+    });
+
+    bench("board hash", [&] (long i) {
+        sink += boards[i & mask].hash();
+    });
+
+    // Every board stored once, the probes then all hit
+    TranspositionTable table(16);
+    for (const Board& board : boards)
+        table.store(board.hash(), 1.0);
+    bench("transposition probe", [&] (long i) {
+        double score = 0;
+        sink += table.probe(boards[i & mask].hash(), score) ? static_cast<long>(score) : 0;
+    });
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+#ifndef TETRIS_BLOCK_H
+#define TETRIS_BLOCK_H
+
+#include <cstdint>
+#include <type_traits>
+
+//------------------------------------------------------------------------------------
+// Data
+//------------------------------------------------------------------------------------
+enum BlockState { EMPTY, MOVING, BLOCK, WALL, FADING };
+
+enum BlockType { I, O, T, S, Z, J, L, BLOCKTYPE_COUNT };
+
+// A 4x4 block shape is stored as a 16-bit mask, bit 4 * i + j is row i, column j.
+// Shapes are written as 16 characters, four per row, '#' for a filled cell.
+constexpr uint16_t
+makeShape (const char* cells)
+{
+    uint16_t shape = 0;
+    for (int k = 0; k < 16; k++) {
+        if (cells[k] == '#')
+            shape |= 1 << k;
+    }
+    return shape;
+}
+
+// Rotate a shape clockwise inside the size x size box at the top right of its
+// 4x4 matrix, the cells must all be in the box
+constexpr uint16_t
+rotateShape (uint16_t shape, int size = 4)
+{
+    uint16_t rotated = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            if ((shape >> (4 * i + j)) & 1)
+                rotated |= 1 << (4 * (j - (4 - size)) + (3 - i));
+        }
+    }
+    return rotated;
+}
+
+constexpr uint16_t blockShapes[BLOCKTYPE_COUNT] = {
+    makeShape("...." // I
+              "####"
+              "...."
+              "...."),
+    makeShape("...." // O
+              ".##."
+              ".##."
+              "...."),
+    makeShape("...." // T
+              ".###"
+              "..#."
+              "...."),
+    makeShape("...." // S
+              "..##"
+              ".##."
+              "...."),
+    makeShape("...." // Z
+              ".##."
+              "..##"
+              "...."),
+    makeShape("...." // J
+              ".###"
+              ".#.."
+              "...."),
+    makeShape("...." // L
+              ".###"
+              "...#"
+              "...."),
+};
+
+// Top-left corner of the bounding box of a shape, as 4 * row + column
+constexpr int
+shapeCorner (uint16_t shape)
+{
+    int row = 4, col = 4;
+    for (int k = 0; k < 16; k++) {
+        if ((shape >> k) & 1) {
+            row = k / 4 < row ? k / 4 : row;
+            col = k % 4 < col ? k % 4 : col;
+        }
+    }
+    return 4 * row + col;
+}
+
+// Shape moved up and left against the top-left corner of the 4x4 matrix
+constexpr uint16_t
+alignShape (uint16_t shape)
+{
+    uint16_t aligned = 0;
+    int corner = shapeCorner(shape);
+    for (int k = 0; k < 16; k++) {
+        if ((shape >> k) & 1)
+            aligned |= 1 << (k - corner);
+    }
+    return aligned;
+}
+
+// SRS (Super Rotation System) wall kicks of the clockwise rotation from each
+// SRS state (0 spawn, R, 2, L), as x right and y up like the guideline tables.
+// The first offset where the rotated block fits is taken.
+static const int kickTests = 5;
+
+constexpr int8_t srsKicks[4][kickTests][2] = {
+    { { 0, 0 }, { -1, 0 }, { -1,  1 }, { 0, -2 }, { -1, -2 } }, // 0 -> R
+    { { 0, 0 }, {  1, 0 }, {  1, -1 }, { 0,  2 }, {  1,  2 } }, // R -> 2
+    { { 0, 0 }, {  1, 0 }, {  1,  1 }, { 0, -2 }, {  1, -2 } }, // 2 -> L
+    { { 0, 0 }, { -1, 0 }, { -1, -1 }, { 0,  2 }, { -1,  2 } }, // L -> 0
+};
+constexpr int8_t srsKicksI[4][kickTests][2] = {
+    { { 0, 0 }, { -2, 0 }, {  1, 0 }, { -2, -1 }, {  1,  2 } },
+    { { 0, 0 }, { -1, 0 }, {  2, 0 }, { -1,  2 }, {  2, -1 } },
+    { { 0, 0 }, {  2, 0 }, { -1, 0 }, {  2,  1 }, { -1, -2 } },
+    { { 0, 0 }, {  1, 0 }, { -2, 0 }, {  1, -2 }, { -2,  1 } },
+};
+
+//
+// Every orientation of every block, generated at compile time. Blocks rotate
+// like SRS: I inside the whole 4x4 matrix, O not at all and the others inside
+// the 3x3 box of its top right corner. The I block spawns in SRS state 0 and
+// the others, flat side up, in SRS state 2.
+//
+struct RotationTable {
+    uint16_t shapes[BLOCKTYPE_COUNT][4];
+    // First orientation covering the same cells as orientation r, moved by
+    // offsetX, offsetY (O has one distinct orientation, I, S and Z have two)
+    uint8_t canonical[BLOCKTYPE_COUNT][4];
+    int8_t  offsetX[BLOCKTYPE_COUNT][4];
+    int8_t  offsetY[BLOCKTYPE_COUNT][4];
+    // Moves tried in order by the clockwise rotation from orientation r, y down
+    int8_t  kickX[BLOCKTYPE_COUNT][4][kickTests];
+    int8_t  kickY[BLOCKTYPE_COUNT][4][kickTests];
+
+    constexpr RotationTable () : shapes(), canonical(), offsetX(), offsetY(), kickX(), kickY() {
+        for (int t = 0; t < BLOCKTYPE_COUNT; t++) {
+            shapes[t][0] = blockShapes[t];
+            for (int r = 1; r < 4; r++) {
+                // Avoid rotating O shape
+                shapes[t][r] = (t == O) ? shapes[t][r - 1] : rotateShape(shapes[t][r - 1], t == I ? 4 : 3);
+            }
+
+            // O never needs a kick, its table stays all zeros
+            for (int r = 0; t != O && r < 4; r++) {
+                for (int k = 0; k < kickTests; k++) {
+                    const int8_t* kick = t == I ? srsKicksI[r][k] : srsKicks[(r + 2) & 3][k];
+                    kickX[t][r][k] = kick[0];
+                    kickY[t][r][k] = static_cast<int8_t>(-kick[1]);
+                }
+            }
+
+            for (int r = 0; r < 4; r++) {
+                int c = 0;
+                while (alignShape(shapes[t][c]) != alignShape(shapes[t][r]))
+                    c++;
+                int from = shapeCorner(shapes[t][r]), to = shapeCorner(shapes[t][c]);
+                canonical[t][r] = static_cast<uint8_t>(c);
+                offsetX[t][r] = static_cast<int8_t>(from % 4 - to % 4);
+                offsetY[t][r] = static_cast<int8_t>(from / 4 - to / 4);
+            }
+        }
+    }
+};
+
+constexpr RotationTable blockRotations;
+
+static_assert(blockRotations.shapes[I][1] == makeShape("..#."
+                                                       "..#."
+                                                       "..#."
+                                                       "..#."), "I block rotates clockwise");
+static_assert(blockRotations.shapes[T][1] == makeShape("..#."
+                                                       ".##."
+                                                       "..#."
+                                                       "...."), "T block rotates around its center");
+static_assert(blockRotations.canonical[I][2] == 0 && blockRotations.offsetY[I][2] == 1 &&
+              blockRotations.canonical[O][3] == 0 && blockRotations.canonical[T][3] == 3,
+              "Orientations covering the same cells share a canonical one");
+
+//------------------------------------------------------------------------------------
+// Classes
+//------------------------------------------------------------------------------------
+// A block is just its type, orientation and position, shapes come from blockRotations
+class Block {
+public:
+    BlockType type;
+    int rotation;
+    int posX, posY;
+
+    Block (BlockType t = I) : type(t), rotation(0), posX(0), posY(0) {}
+
+    void setPosition (int x, int y) { posX = x; posY = y; }
+    void rotate () { rotation = (rotation + 1) & 3; }
+    void moveDown () { posY++; };
+    void moveLeft () { posX--; };
+    void moveRight () { posX++; };
+
+    uint16_t mask () const { return blockRotations.shapes[type][rotation]; }
+    uint16_t rotationPreview () const { return blockRotations.shapes[type][(rotation + 1) & 3]; }
+    bool isFilled (int i, int j) const { return (mask() >> (4 * i + j)) & 1; }
+};
+
+static_assert(std::is_trivially_copyable<Block>::value, "Blocks are plain values");
+
+#endif /* TETRIS_BLOCK_H */
@@ -0,0 +1,260 @@
+#ifndef TETRIS_BOARD_H
+#define TETRIS_BOARD_H
+
+#include <array>
+#include <cstdint>
+
+//------------------------------------------------------------------------------------
+// Bit utils, compiler builtins with a portable fallback
+//------------------------------------------------------------------------------------
+inline int
+popCount (uint32_t bits)
+{
+#if defined(__GNUC__)
+    return __builtin_popcount(bits);
+#else
+    int count = 0;
+    for (; bits; bits &= bits - 1)
+        count++;
+    return count;
+#endif
+}
+
+// Index of the lowest set bit, bits must not be 0
+inline int
+lowestBit (uint64_t bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int index = 0;
+    for (; !(bits & 1); bits >>= 1)
+        index++;
+    return index;
+#endif
+}
+
+// Index of the highest set bit, bits must not be 0
+inline int
+highestBit (uint32_t bits)
+{
+#if defined(__GNUC__)
+    return 31 - __builtin_clz(bits);
+#else
+    int index = 0;
+    while (bits >>= 1)
+        index++;
+    return index;
+#endif
+}
+
+//------------------------------------------------------------------------------------
+// Board
+//------------------------------------------------------------------------------------
+//
+// Compact bitboard of the game grid. Every row is a 32-bit mask where bit 0
+// is the left wall, bits 1..cols are the playfield and every bit from cols + 1
+// upward is the right wall. Row `rowsN` is the bottom wall. A 4x4 block shape
+// is a 16-bit mask (bit 4 * i + j is cell i, j), so a collision test is one
+// AND per block row.
+// The board also keeps every playfield column as a 32-bit mask (bit i is row
+// i), so the distance a block can fall is found without walking the rows.
+//
+// The drop distance and the garbage take the width as a template argument
+// when it is known at compile time, Cols 0 for any width, so the standard 10
+// wide grid gets fully unrolled column loops (Tetris picks the version once
+// per tick). Collision tests and placement do not depend on the width, the
+// walls are bits of the rows, and removing rows is bound by the row moves.
+//
+class Board {
+public:
+    static const int maxRows = 32;
+    static const int maxCols = 16;
+    static const uint32_t fullRow = 0xFFFFFFFFu;
+
+private:
+    std::array<uint32_t, maxRows + 1> rows;
+    std::array<uint32_t, maxCols> columns; // Column j + 1 of the playfield, bit i set when filled
+    int colsN, rowsN;
+    uint32_t emptyRow;
+    uint32_t dirtyRows; // Bit i set when row i changed since the last clearDirtyRows()
+
+    // Row mask, anything outside the grid is solid
+    uint32_t rowAt (int i) const {
+        return (unsigned) i <= (unsigned) rowsN ? rows[i] : fullRow;
+    }
+
+public:
+    void reset (int cols, int rowsCount);
+
+    bool collides (uint16_t shape, int x, int y) const;
+    void place (uint16_t shape, int x, int y);
+    // Remove every row of the mask in one pass, bit i is row i
+    void removeRows (uint32_t mask);
+    // Rows the shape at x, y can fall before it rests on the stack or the floor
+    template <int Cols = 0> int dropDistance (uint16_t shape, int x, int y) const;
+    // Push the stack up and fill the bottom count rows, all but column hole
+    // (1 to cols). Returns true when filled cells were pushed past the top.
+    template <int Cols = 0> bool insertGarbage (int count, int hole);
+
+    bool isRowFull (int i) const { return rows[i] == fullRow; }
+    bool isRowEmpty (int i) const { return rows[i] == emptyRow; }
+    bool isFilled (int i, int j) const { return (rows[i] >> j) & 1; }
+    bool isWall (int i, int j) const { return i == rowsN || j == 0 || j > colsN; }
+    int getCols () const { return colsN; }
+    int getRows () const { return rowsN; }
+    uint32_t fieldMask () const { return ~emptyRow; }
+    uint32_t row (int i) const { return rows[i]; }
+    // Column j (1 to cols), bit i set when row i is filled
+    uint32_t column (int j) const { return columns[j - 1]; }
+
+    // Hash of the size and cells, the same whatever the moves that led to
+    // them, for transposition tables
+    uint64_t hash () const;
+
+    uint32_t getDirtyRows () const { return dirtyRows; }
+    void clearDirtyRows () { dirtyRows = 0; }
+    void setAllDirty () { dirtyRows = rowsN >= 32 ? ~0u : (1u << rowsN) - 1; }
+
+    // Bits of row i of a block shape, moved to grid column x
+    static uint32_t shapeRow (uint16_t shape, int i, int x) {
+        uint32_t bits = (shape >> (4 * i)) & 0xF;
+        if (x >= 0)
+            return bits << x;
+        // Cells pushed past the left edge can never fit, map them on the outer wall
+        return (bits & ((1u << -x) - 1)) ? 0x80000000u : bits >> -x;
+    }
+};
+
+inline void
+Board::reset (int cols, int rowsCount)
+{
+    colsN = cols; rowsN = rowsCount;
+    emptyRow = ~(((1u << colsN) - 1) << 1);
+
+    for (int i = 0; i < rowsN; i++)
+        rows[i] = emptyRow;
+    rows[rowsN] = fullRow; // Bottom wall
+    columns.fill(0);
+    setAllDirty();
+}
+
+inline bool
+Board::collides (uint16_t shape, int x, int y) const
+{
+    for (int i = 0; i < 4; i++) {
+        uint32_t bits = shapeRow(shape, i, x);
+        if (bits && (bits & rowAt(y + i)))
+            return true;
+    }
+    return false;
+}
+
+inline void
+Board::place (uint16_t shape, int x, int y)
+{
+    for (int i = 0; i < 4; i++) {
+        uint32_t bits = shapeRow(shape, i, x);
+        if (bits && y + i >= 0 && y + i < rowsN) {
+            rows[y + i] |= bits;
+            dirtyRows |= 1u << (y + i);
+
+            for (bits &= ~emptyRow; bits; bits &= bits - 1)
+                columns[lowestBit(bits) - 1] |= 1u << (y + i);
+        }
+    }
+}
+
+inline void
+Board::removeRows (uint32_t mask)
+{
+    if (!mask)
+        return;
+
+    // Stable compaction from the bottom, the kept rows slide over the removed ones
+    int to = rowsN - 1;
+    for (int from = rowsN - 1; from >= 0; from--) {
+        if (!((mask >> from) & 1))
+            rows[to--] = rows[from];
+    }
+    for (; to >= 0; to--)
+        rows[to] = emptyRow;
+
+    // Top removed row first, so the index of the next ones is still valid
+    for (uint32_t bits = mask; bits; bits &= bits - 1) {
+        int i = lowestBit(bits);
+        uint32_t above = (1u << i) - 1;
+        for (int j = 0; j < colsN; j++)
+            columns[j] = ((columns[j] & above) << 1) | (columns[j] & ~(above | (1u << i)));
+    }
+
+    dirtyRows |= (2u << highestBit(mask)) - 1; // The lowest removed row and all the ones above moved
+}
+
+template <int Cols>
+inline int
+Board::dropDistance (uint16_t shape, int x, int y) const
+{
+    const int cols = Cols > 0 ? Cols : colsN;
+    int distance = rowsN;
+    for (int j = 0; j < 4; j++) {
+        uint32_t cells = (shape >> j) & 0x1111; // Column j of the shape, one bit every 4
+        int col = x + j;
+        if (!cells || col < 1 || col > cols)
+            continue;
+
+        // First filled row under the lowest cell, the floor below them all
+        int under = y + highestBit(cells) / 4 + 1;
+        int start = under < 0 ? 0 : under;
+        uint64_t below = (static_cast<uint64_t>(columns[col - 1]) | (1ull << rowsN)) >> start;
+        int fall = lowestBit(below) + start - under;
+        if (fall < distance)
+            distance = fall;
+    }
+    return distance;
+}
+
+template <int Cols>
+inline bool
+Board::insertGarbage (int count, int hole)
+{
+    if (count <= 0)
+        return false;
+    const int cols = Cols > 0 ? Cols : colsN;
+    count = count < rowsN ? count : rowsN;
+
+    bool overflow = false;
+    for (int i = 0; i < count; i++)
+        overflow |= (rows[i] & ~emptyRow) != 0;
+
+    for (int i = 0; i < rowsN - count; i++)
+        rows[i] = rows[i + count];
+    for (int i = rowsN - count; i < rowsN; i++)
+        rows[i] = fullRow & ~(1u << hole);
+
+    // Columns move up the same way, then every one but the hole gets the new rows
+    uint32_t garbage = static_cast<uint32_t>(((1ull << count) - 1) << (rowsN - count));
+    for (int j = 0; j < cols; j++) {
+        columns[j] >>= count;
+        if (j + 1 != hole)
+            columns[j] |= garbage;
+    }
+
+    setAllDirty();
+    return overflow;
+}
+
+inline uint64_t
+Board::hash () const
+{
+    // Each row mask folded in with a multiply and a shift, the bottom wall is
+    // the same on every board of the size
+    uint64_t h = static_cast<uint64_t>(colsN) << 8 | static_cast<uint64_t>(rowsN);
+    for (int i = 0; i < rowsN; i++) {
+        h = (h ^ rows[i]) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+#endif /* TETRIS_BOARD_H */
@@ -0,0 +1,670 @@
+//
+// Checks of the core that the benchmarks cannot catch: the columns a board
+// keeps must follow its rows through every change, the vector kernels
+// must give exactly the results of the plain code they replace, the paths
+// of the placement search must lock the block where it says, a rollback
+// session getting late and shuffled remote inputs must confirm the games of
+// one getting them on time, replays must play the recorded games again and
+// refuse the damaged ones, a task throwing in the pool must reach the
+// caller and leave the pool working, and the profiler read on one thread while another one runs frames must only give
+// whole frames (make tsan runs them under ThreadSanitizer). Prints every check
+// and exits with 1 when one fails.
+//
+// Usage: tetris-check
+//
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+#include "evaluation.h"
+#include "placement.h"
+#include "profiler.h"
+#include "randomizer.h"
+#include "replay.h"
+#include "rollback.h"
+#include "scheduler.h"
+
+//------------------------------------------------------------------------------------
+// Constants Definition
+//------------------------------------------------------------------------------------
+static const int boardsCount = 1000;
+static const int boardChanges = 500; // Places, removed rows and garbage per board
+static const uint32_t checkSeed = 1;
+static const int sessionsCount = 20;
+static const long sessionLength = 20000; // Ticks of input, random play ends much sooner
+
+//------------------------------------------------------------------------------------
+// Utils
+//------------------------------------------------------------------------------------
+static int failures = 0;
+
+static void
+check (const char* name, bool passed)
+{
+    std::printf("%-40s %s\n", name, passed ? "ok" : "FAILED");
+    failures += !passed;
+}
+
+// Random stacks with holes, wells and full rows, of the given size or of a
+// random one for every board when cols is 0
+static std::vector<Board>
+makeBoards (Random& rng, int cols, int rows)
+{
+    std::vector<Board> boards(boardsCount);
+
+    for (Board& board : boards) {
+        int c = cols > 0 ? cols : 4 + rng.below(Board::maxCols - 3);
+        int r = rows > 0 ? rows : 4 + rng.below(Board::maxRows - 3);
+        board.reset(c, r);
+        int height = rng.below(r + 1);
+        for (int i = r - height; i < r; i++) {
+            bool full = rng.below(5) == 0;
+            for (int j = 1; j <= c; j++) {
+                if (full || rng.below(3) != 0)
+                    board.place(1, j, i); // Single cell shape
+            }
+        }
+    }
+    return boards;
+}
+
+static bool
+sameFeatures (const BoardFeatures& a, const BoardFeatures& b, int cols)
+{
+    for (int j = 0; j < cols; j++) {
+        if (a.heights[j] != b.heights[j])
+            return false;
+    }
+    return a.aggregateHeight == b.aggregateHeight && a.maxHeight == b.maxHeight &&
+           a.holes == b.holes && a.bumpiness == b.bumpiness &&
+           a.rowTransitions == b.rowTransitions && a.columnTransitions == b.columnTransitions &&
+           a.wells == b.wells && a.completeLines == b.completeLines;
+}
+
+// The batch features, vectorized when the target has SIMD, against the single board ones
+static bool
+batchMatchesSingle (const std::vector<Board>& boards)
+{
+    std::vector<BoardFeatures> features(boards.size());
+    computeFeatures(boards.data(), static_cast<int>(boards.size()), features.data());
+
+    for (size_t b = 0; b < boards.size(); b++) {
+        if (!sameFeatures(features[b], computeFeatures(boards[b]), boards[b].getCols()))
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Board
+//------------------------------------------------------------------------------------
+// The columns built again from the rows
+static bool
+columnsMatchRows (const Board& board)
+{
+    for (int j = 1; j <= board.getCols(); j++) {
+        uint32_t column = 0;
+        for (int i = 0; i < board.getRows(); i++)
+            column |= static_cast<uint32_t>(board.isFilled(i, j)) << i;
+        if (board.column(j) != column)
+            return false;
+    }
+    return true;
+}
+
+// Rows the shape falls moving down one row at a time
+static int
+stepDownDistance (const Board& board, uint16_t shape, int x, int y)
+{
+    int distance = 0;
+    while (!board.collides(shape, x, y + distance + 1))
+        distance++;
+    return distance;
+}
+
+// Random blocks dropped, rows removed (full ones or any) and garbage pushed
+// in, on boards of every size: after each change the columns must match the
+// rows, and the drop distance the step by step fall of the block, with the
+// any width code and the 10 wide one
+static bool
+boardChangesKeepColumns (Random& rng)
+{
+    Board board;
+    for (int n = 0; n < boardsCount / 5; n++) {
+        int cols = n % 2 ? gridCols : 4 + rng.below(Board::maxCols - 3);
+        int rows = 4 + rng.below(Board::maxRows - 3);
+        board.reset(cols, rows);
+
+        for (int c = 0; c < boardChanges; c++) {
+            int change = rng.below(10);
+            if (change < 7) {
+                uint16_t shape = blockRotations.shapes[rng.below(BLOCKTYPE_COUNT)][rng.below(4)];
+                int x = rng.below(cols + 3) - 2, y = rng.below(rows + 2) - 2;
+                if (board.collides(shape, x, y))
+                    continue;
+                int distance = board.dropDistance(shape, x, y);
+                if (distance != stepDownDistance(board, shape, x, y) ||
+                    (cols == gridCols && board.dropDistance<gridCols>(shape, x, y) != distance))
+                    return false;
+                board.place(shape, x, y + distance);
+            }
+            else if (change < 9) {
+                uint32_t mask = 0;
+                for (int i = 0; i < rows; i++) {
+                    if (board.isRowFull(i) || rng.below(rows) == 0)
+                        mask |= 1u << i;
+                }
+                board.removeRows(mask);
+            }
+            else if (cols == gridCols && rng.below(2) == 0)
+                board.insertGarbage<gridCols>(1 + rng.below(4), 1 + rng.below(cols));
+            else
+                board.insertGarbage(1 + rng.below(4), 1 + rng.below(cols));
+
+            if (!columnsMatchRows(board))
+                return false;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Placements
+//------------------------------------------------------------------------------------
+// Standard rules without the gravity (the least there is) nor a lock delay
+// ending a path half way, so the block only moves with the presses
+static GameConfig
+pathConfig ()
+{
+    GameConfig config;
+    for (int32_t& gravity : config.gravityCurve)
+        gravity = 1;
+    config.lockDelay = 1 << 20;
+    config.softDropDelay = 0;
+    return config;
+}
+
+// A new game whose first block is of the given type
+static Tetris
+gameStartingWith (BlockType type)
+{
+    for (uint32_t seed = 1; ; seed++) {
+        Tetris game(pathConfig(), seed);
+        if (game.getMovingBlock()->type == type)
+            return game;
+    }
+}
+
+static bool
+placementsCount (BlockType type, int expected)
+{
+    Tetris game = gameStartingWith(type);
+    PlacementFinder finder;
+    return static_cast<int>(finder.find(game.getBoard(), *game.getMovingBlock()).size()) == expected;
+}
+
+// Plays the path of p in the game, one press per tick and a release between
+// two presses, then a hard drop: the block must lock on the cells of p
+static bool
+pathLocksOnPlacement (Tetris game, const PlacementFinder& finder, const Placement& p)
+{
+    std::vector<Action> steps;
+    finder.path(p, steps);
+    for (Action step : steps) {
+        game.update(step);
+        game.update(ACTION_NONE);
+    }
+
+    Board expected = game.getBoard();
+    expected.place(p.block.mask(), p.block.posX, p.block.posY);
+    game.update(ACTION_HARD_DROP);
+
+    if (game.getMovingBlock() != nullptr)
+        return false;
+    for (int i = 0; i < expected.getRows(); i++) {
+        if (game.getBoard().row(i) != expected.row(i))
+            return false;
+    }
+    return true;
+}
+
+static bool
+pathsLockOnPlacements (const Tetris& game)
+{
+    PlacementFinder finder;
+    for (const Placement& p : finder.find(game.getBoard(), *game.getMovingBlock())) {
+        if (!pathLocksOnPlacement(game, finder, p))
+            return false;
+    }
+    return true;
+}
+
+// Every path of every block on an empty board, then on the stacks of games
+// played with random keys, where the paths go under overhangs and kick
+static bool
+placementPathsLock (Random& rng)
+{
+    for (int type = 0; type < BLOCKTYPE_COUNT; type++) {
+        if (!pathsLockOnPlacements(gameStartingWith(static_cast<BlockType>(type))))
+            return false;
+    }
+
+    for (uint32_t seed = 1; seed <= 200; seed++) {
+        Tetris game(pathConfig(), seed);
+        unsigned actions = ACTION_NONE;
+        for (long t = rng.below(2000); t > 0 && !game.isGameOver(); t--) {
+            if (t % 8 == 0)
+                actions = rng.next() & (ACTION_LEFT | ACTION_RIGHT | ACTION_ROTATE | ACTION_SOFT_DROP | ACTION_HARD_DROP);
+            game.update(actions);
+        }
+        // Paths start from a block as it spawns, the next one once the cleared
+        // rows faded out
+        game.update(ACTION_NONE);
+        game.update(ACTION_HARD_DROP);
+        do
+            game.update(ACTION_NONE);
+        while (!game.isGameOver() && game.getMovingBlock() == nullptr);
+
+        if (!game.isGameOver() && !pathsLockOnPlacements(game))
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Rollback
+//------------------------------------------------------------------------------------
+// Random keys held a few ticks each, the actions played on every tick. The
+// first inputDelay ticks have none, like in a session.
+static std::vector<uint8_t>
+makeInputs (Random& rng, int inputDelay)
+{
+    std::vector<uint8_t> inputs(sessionLength + RollbackSession::maxInputDelay, ACTION_NONE);
+    unsigned keys = ACTION_NONE;
+    for (size_t t = inputDelay; t < inputs.size(); t++) {
+        if (rng.below(6) == 0)
+            keys = rng.next() & (ACTION_LEFT | ACTION_RIGHT | ACTION_ROTATE | ACTION_SOFT_DROP | ACTION_HARD_DROP);
+        inputs[t] = static_cast<uint8_t>(keys);
+    }
+    return inputs;
+}
+
+// Hashes of both games after every tick, the remote inputs known before
+// each tick is played, so none is predicted. Empty when the game never ends.
+static std::vector<uint64_t>
+lockstepHashes (const RollbackOptions& options, const std::vector<uint8_t> inputs[2], int& winner)
+{
+    std::unique_ptr<RollbackSession> session(new RollbackSession(options, 0));
+    std::vector<uint64_t> hashes;
+
+    while (!session->isOver() && session->getTicks() < sessionLength) {
+        long tick = session->getTicks();
+        session->addRemoteActions(tick, inputs[1][tick]);
+        session->advance(inputs[0][tick + options.inputDelay]);
+        if (session->getTicks() > tick) {
+            hashes.push_back(session->getGame(0).hash());
+            hashes.push_back(session->getGame(1).hash());
+        }
+    }
+
+    winner = session->getWinner();
+    if (!session->isOver())
+        hashes.clear();
+    return hashes;
+}
+
+// The same inputs, the remote ones arriving late, out of order, twice or not
+// at all until sent again. After every tick, a copy of the session receiving
+// the rest of the remote inputs played so far must confirm the lockstep
+// games, and the session must end on the same tick as the lockstep one, the
+// ticks it ran past the end on predictions undone.
+static bool
+rollbackMatchesLockstep (Random& rng, int local, long& resimulated)
+{
+    RollbackOptions options;
+    options.seed = rng.next();
+    options.inputDelay = rng.below(5);
+    std::vector<uint8_t> inputs[2] = { makeInputs(rng, options.inputDelay), makeInputs(rng, options.inputDelay) };
+
+    int winner;
+    std::vector<uint64_t> hashes = lockstepHashes(options, inputs, winner);
+    if (hashes.empty())
+        return false;
+
+    int remote = 1 - local;
+    std::unique_ptr<RollbackSession> session(new RollbackSession(options, local));
+    std::unique_ptr<RollbackSession> confirmed(new RollbackSession(options, local));
+    std::vector<long> packets;
+
+    for (long step = 0; !session->isOver() && step < 4 * sessionLength; step++) {
+        // Nothing on some ticks, else the next few inputs shuffled, some lost
+        packets.clear();
+        if (rng.below(4) != 0) {
+            long first = std::max(0l, session->getRemoteTicks() - 1);
+            for (long tick = first, end = first + 1 + rng.below(6); tick < end && tick < sessionLength; tick++) {
+                if (rng.below(5) != 0)
+                    packets.push_back(tick);
+            }
+            for (size_t i = packets.size(); i > 1; i--)
+                std::swap(packets[i - 1], packets[rng.below(static_cast<int>(i))]);
+        }
+        for (long tick : packets)
+            session->addRemoteActions(tick, inputs[remote][tick]);
+
+        session->advance(inputs[local][session->getTicks() + options.inputDelay]);
+
+        *confirmed = *session;
+        for (long tick = confirmed->getRemoteTicks(); tick < confirmed->getTicks(); tick++)
+            confirmed->addRemoteActions(tick, inputs[remote][tick]);
+        confirmed->resolve();
+
+        long tick = confirmed->getTicks() - 1;
+        if (tick < 0)
+            continue;
+        if (2 * tick + 1 >= static_cast<long>(hashes.size()) ||
+            confirmed->getGame(0).hash() != hashes[2 * tick] ||
+            confirmed->getGame(1).hash() != hashes[2 * tick + 1])
+            return false;
+    }
+
+    resimulated += session->getResimulatedTicks();
+    return session->isOver() && session->getWinner() == winner &&
+           2 * session->getTicks() == static_cast<long>(hashes.size()) &&
+           session->getGame(0).hash() == hashes[hashes.size() - 2] &&
+           session->getGame(1).hash() == hashes[hashes.size() - 1];
+}
+
+static bool
+rollbackSessionsMatchLockstep (Random& rng)
+{
+    long resimulated = 0;
+    for (int i = 0; i < sessionsCount; i++) {
+        if (!rollbackMatchesLockstep(rng, i & 1, resimulated))
+            return false;
+    }
+    // Else no input was mispredicted, and the check proves nothing
+    return resimulated > 0;
+}
+
+//------------------------------------------------------------------------------------
+// Replays
+//------------------------------------------------------------------------------------
+static bool
+throwsOnLoad (const char* path, const std::vector<uint8_t>& data)
+{
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+    try {
+        ReplayPlayer player(path);
+    }
+    catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+// Records the game played by the agent, saves the replay and plays it again:
+// the game must end on the same tick with the same score and hash. Every
+// shorter part of the file, and the file followed by continuation bytes
+// where its trailing varint was, must throw instead of reading past the end.
+static bool
+replayRoundTrips (const GameConfig& config, uint32_t seed, Agent& agent, long maxTicks)
+{
+    static const char* path = "tetris-check.replay";
+
+    Tetris game(config, seed);
+    ReplayRecorder recorder(ReplayHeader::fromGame(game));
+    for (long t = 0; t < maxTicks && !game.isGameOver(); t++) {
+        unsigned actions = agent.act(game);
+        recorder.record(actions);
+        game.update(actions);
+    }
+    recorder.save(path);
+
+    std::vector<uint8_t> data;
+    {
+        std::ifstream file(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    bool passed = false;
+    {
+        ReplayPlayer player(path);
+        Tetris replayed = player.getHeader().createGame();
+        passed = player.seek(replayed, player.getTicks()) == recorder.getTicks() &&
+                 replayed.getTicksCount() == game.getTicksCount() &&
+                 replayed.getScore() == game.getScore() && replayed.hash() == game.hash() &&
+                 replayed.isGameOver() == game.isGameOver();
+    }
+
+    for (size_t size = 0; passed && size < data.size(); size++)
+        passed = throwsOnLoad(path, std::vector<uint8_t>(data.begin(), data.begin() + size));
+
+    std::vector<uint8_t> corrupt(data);
+    corrupt.back() |= 0x80;
+    for (int i = 0; passed && i < 10; i++) {
+        passed = throwsOnLoad(path, corrupt);
+        corrupt.push_back(0x80);
+    }
+
+    std::remove(path);
+    return passed;
+}
+
+static bool
+sameHeader (const ReplayHeader& a, const ReplayHeader& b)
+{
+    const GameConfig& c = a.config;
+    const GameConfig& d = b.config;
+    return a.seed == b.seed && c.cols == d.cols && c.rows == d.rows && c.randomizer == d.randomizer &&
+           c.previewCount == d.previewCount && c.startLevel == d.startLevel &&
+           c.linesPerLevel == d.linesPerLevel &&
+           std::equal(c.gravityCurve, c.gravityCurve + GameConfig::maxLevels, d.gravityCurve) &&
+           c.lockDelay == d.lockDelay && c.softDropDelay == d.softDropDelay &&
+           c.autoShiftDelay == d.autoShiftDelay && c.autoRepeatRate == d.autoRepeatRate &&
+           c.fadingTime == d.fadingTime && std::equal(c.lineScores, c.lineScores + 5, d.lineScores);
+}
+
+// A header decodes to the one encoded, and a shorter one, or one whose
+// config is not valid, throws
+static bool
+headerRoundTrips (const GameConfig& config, uint32_t seed)
+{
+    std::vector<uint8_t> data;
+    ReplayHeader header = { seed, config };
+    header.encode(data);
+
+    size_t pos = 0;
+    if (!sameHeader(ReplayHeader::decode(data, pos), header) || pos != data.size())
+        return false;
+
+    for (size_t size = 0; size < data.size(); size++) {
+        std::vector<uint8_t> part(data.begin(), data.begin() + size);
+        try {
+            pos = 0;
+            ReplayHeader::decode(part, pos);
+            return false;
+        }
+        catch (const std::runtime_error&) {}
+    }
+
+    // No rows, the varint right after the cols one
+    data.clear();
+    header.config.rows = 0;
+    header.encode(data);
+    try {
+        pos = 0;
+        ReplayHeader::decode(data, pos);
+        return false;
+    }
+    catch (const std::runtime_error&) {}
+    return true;
+}
+
+// Settings away from the defaults, so every field of the header counts
+static GameConfig
+customConfig ()
+{
+    GameConfig config;
+    config.cols = 12;
+    config.rows = 24;
+    config.randomizer = RANDOMIZER_BAG;
+    config.previewCount = 3;
+    config.startLevel = 7;
+    config.linesPerLevel = 4;
+    config.lockDelay = 12;
+    config.softDropDelay = 3;
+    config.autoShiftDelay = 9;
+    config.autoRepeatRate = 0;
+    config.fadingTime = 20;
+    config.lineScores[4] = 2000;
+    return config;
+}
+
+//------------------------------------------------------------------------------------
+// Scheduler
+//------------------------------------------------------------------------------------
+// Runs where one task throws, on any worker's range, then where every task
+// throws: run() must rethrow one of the exceptions, and the next run() of
+// the same pool must still run every task exactly once
+static bool
+poolRethrowsAndRecovers ()
+{
+    static const int tasksCount = 1000;
+    static const int runsCount = 50;
+
+    WorkStealingPool pool(4);
+    std::unique_ptr<std::atomic<int>[]> runs(new std::atomic<int>[tasksCount]);
+
+    for (int r = 0; r <= runsCount; r++) {
+        // The last run has every task throw
+        int thrower = r < runsCount ? r * tasksCount / runsCount : -1;
+        std::string message;
+        try {
+            pool.run(tasksCount, [thrower] (int index, int) {
+                if (thrower < 0 || index == thrower)
+                    throw std::runtime_error("task " + std::to_string(index));
+            });
+        }
+        catch (const std::runtime_error& e) {
+            message = e.what();
+        }
+        if (thrower >= 0 ? message != "task " + std::to_string(thrower) : message.compare(0, 5, "task ") != 0)
+            return false;
+
+        for (int i = 0; i < tasksCount; i++)
+            runs[i].store(0, std::memory_order_relaxed);
+        pool.run(tasksCount, [&runs] (int index, int) { runs[index].fetch_add(1, std::memory_order_relaxed); });
+        for (int i = 0; i < tasksCount; i++) {
+            if (runs[i].load(std::memory_order_relaxed) != 1)
+                return false;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Profiler
+//------------------------------------------------------------------------------------
+// One thread runs frames while this one exports them, like the simulation and
+// the render threads. Every frame puts the same time in three zones, a time
+// the next frames in its slot do not have, so a frame copied while the writer
+// replaced it shows zones that disagree.
+static bool
+profilerExportsWholeFrames ()
+{
+    static const char* path = "tetris-check-profile.csv";
+    static const int framesCount = 200000;
+
+    std::unique_ptr<Profiler> p(new Profiler());
+    std::atomic<bool> done(false);
+
+    std::thread writer([&] {
+        for (int n = 0; n < framesCount; n++) {
+            p->beginFrame();
+            int64_t start = p->now(), time = 1000 + n % 1000;
+            p->add(ZONE_EVENTS, start, start + time);
+            p->add(ZONE_UPDATE, start, start + time);
+            p->add(ZONE_DRAW, start, start + time);
+        }
+        done = true;
+    });
+
+    bool whole = true;
+    long frames = 0;
+    do {
+        p->writeCsv(path);
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line); // Column names
+
+        long long previous = -1;
+        while (std::getline(in, line)) {
+            long long number, start, frame, events, update, draw, text;
+            int fields = std::sscanf(line.c_str(), "%lld,%lld,%lld,%lld,%lld,%lld,%lld",
+                                     &number, &start, &frame, &events, &update, &draw, &text);
+            whole = whole && fields == 7 && number > previous && events == update && update == draw;
+            previous = number;
+            frames++;
+        }
+    } while (!done);
+
+    writer.join();
+    std::remove(path);
+    return whole && frames > 0;
+}
+
+//------------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------------
+int
+main ()
+{
+    Random rng(checkSeed);
+
+    check("board columns and drop distances", boardChangesKeepColumns(rng));
+
+    check("batch features, 10x20", batchMatchesSingle(makeBoards(rng, 10, 20)));
+    check("batch features, 16x32", batchMatchesSingle(makeBoards(rng, 16, 32)));
+    check("batch features, 6x8", batchMatchesSingle(makeBoards(rng, 6, 8)));
+    check("batch features, mixed sizes", batchMatchesSingle(makeBoards(rng, 0, 0)));
+
+    // A tail shorter than a vector goes one by one
+    std::vector<Board> tail = makeBoards(rng, 10, 20);
+    tail.resize(7);
+    check("batch features, 7 boards", batchMatchesSingle(tail));
+
+    // Placements covering the same cells are returned once
+    check("placements of O, empty 10x20", placementsCount(O, 9));
+    check("placements of I, empty 10x20", placementsCount(I, 17));
+    check("placements of S, empty 10x20", placementsCount(S, 17));
+    check("placements of Z, empty 10x20", placementsCount(Z, 17));
+    check("placements of T, empty 10x20", placementsCount(T, 34));
+    check("placements of J, empty 10x20", placementsCount(J, 34));
+    check("placements of L, empty 10x20", placementsCount(L, 34));
+    check("placement paths lock on their placement", placementPathsLock(rng));
+
+    check("rollback confirms the lockstep games", rollbackSessionsMatchLockstep(rng));
+
+    GreedyAgent greedy;
+    RandomAgent random(checkSeed);
+    check("replay of a greedy game", replayRoundTrips(GameConfig(), checkSeed, greedy, 100000));
+    check("replay of a random game, custom rules", replayRoundTrips(customConfig(), checkSeed, random, 100000));
+    check("replay headers", headerRoundTrips(GameConfig(), checkSeed) && headerRoundTrips(customConfig(), ~0u));
+
+    check("pool rethrows and runs again", poolRethrowsAndRecovers());
+
+    check("profiler exports whole frames", profilerExportsWholeFrames());
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "dataset.h"
+
+//------------------------------------------------------------------------------------
+// Constants Definition
+//------------------------------------------------------------------------------------
+static const char datasetMagic[4] = { 'T', 'T', 'D', 'S' };
+static const uint32_t datasetVersion = 1;
+static const size_t headerSize = 64;
+
+//------------------------------------------------------------------------------------
+// Utils
+//------------------------------------------------------------------------------------
+// Write all of the data, through short writes and interruptions
+static bool
+writeAll (int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Records
+//------------------------------------------------------------------------------------
+TrajectoryRecord
+TrajectoryRecord::capture (const Tetris& game, unsigned actions)
+{
+    TrajectoryRecord record = {};
+    const Board& grid = game.getBoard();
+    uint32_t field = (1u << game.getCols()) - 1;
+    for (int i = 0; i < game.getRows(); i++)
+        record.rows[i] = static_cast<uint16_t>((grid.row(i) >> 1) & field);
+
+    record.game = game.getSeed();
+    record.tick = static_cast<uint32_t>(game.getTicksCount());
+    record.piece = 0xFF;
+    if (const Block* block = game.getMovingBlock()) {
+        record.piece = static_cast<uint8_t>(block->type);
+        record.rotation = static_cast<uint8_t>(block->rotation);
+        record.x = static_cast<int8_t>(block->posX);
+        record.y = static_cast<int8_t>(block->posY);
+    }
+    record.next = static_cast<uint8_t>(game.getNextBlock().type);
+    record.actions = static_cast<uint8_t>(actions);
+    return record;
+}
+
+//------------------------------------------------------------------------------------
+// Writer
+//------------------------------------------------------------------------------------
+DatasetWriter::DatasetWriter (const char* path, const GameConfig& config) : written(0)
+{
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error(std::string("Failed to create ") + path);
+
+    uint8_t header[headerSize] = {};
+    uint32_t fields[4] = { datasetVersion, sizeof(TrajectoryRecord),
+                           static_cast<uint32_t>(config.cols), static_cast<uint32_t>(config.rows) };
+    std::memcpy(header, datasetMagic, sizeof(datasetMagic));
+    std::memcpy(header + sizeof(datasetMagic), fields, sizeof(fields));
+
+    if (!writeAll(fd, header, sizeof(header))) {
+        ::close(fd);
+        throw std::runtime_error(std::string("Failed to write ") + path);
+    }
+}
+
+DatasetWriter::~DatasetWriter ()
+{
+    ::close(fd);
+}
+
+void
+DatasetWriter::write (const TrajectoryRecord* records, size_t count)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!writeAll(fd, records, count * sizeof(TrajectoryRecord)))
+        throw std::runtime_error("Failed to write the dataset");
+    written += static_cast<long long>(count);
+}
+
+DatasetWriter::Buffer::Buffer (DatasetWriter& w, size_t capacity) : writer(w)
+{
+    records.reserve(capacity);
+}
+
+DatasetWriter::Buffer::~Buffer ()
+{
+    try {
+        flush();
+    }
+    catch (const std::exception&) {
+        // Lost, like the rest of a dataset cut short
+    }
+}
+
+void
+DatasetWriter::Buffer::flush ()
+{
+    if (records.empty())
+        return;
+    writer.write(records.data(), records.size());
+    records.clear();
+}
+
+//------------------------------------------------------------------------------------
+// Reader
+//------------------------------------------------------------------------------------
+DatasetReader::DatasetReader (const char* path) : data(nullptr), length(0), count(0)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error(std::string("Failed to open ") + path);
+
+    struct stat info;
+    if (fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < headerSize) {
+        ::close(fd);
+        throw std::runtime_error("Not a dataset file");
+    }
+
+    length = static_cast<size_t>(info.st_size);
+    data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // The mapping keeps the file
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        throw std::runtime_error(std::string("Failed to map ") + path);
+    }
+
+    const uint8_t* header = static_cast<const uint8_t*>(data);
+    uint32_t fields[4];
+    std::memcpy(fields, header + sizeof(datasetMagic), sizeof(fields));
+    if (std::memcmp(header, datasetMagic, sizeof(datasetMagic)) || fields[0] != datasetVersion ||
+        fields[1] != sizeof(TrajectoryRecord) || fields[3] > static_cast<uint32_t>(Board::maxRows)) {
+        munmap(data, length);
+        throw std::runtime_error("Not a dataset file, or an unsupported version");
+    }
+
+    cols = static_cast<int>(fields[2]);
+    rows = static_cast<int>(fields[3]);
+    count = (length - headerSize) / sizeof(TrajectoryRecord);
+}
+
+DatasetReader::~DatasetReader ()
+{
+    if (data != nullptr)
+        munmap(data, length);
+}
+
+const TrajectoryRecord*
+DatasetReader::begin () const
+{
+    // The mapping is page aligned and the header 64 bytes, so are the records aligned
+    return reinterpret_cast<const TrajectoryRecord*>(static_cast<const uint8_t*>(data) + headerSize);
+}
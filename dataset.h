@@ -0,0 +1,119 @@
+#ifndef TETRIS_DATASET_H
+#define TETRIS_DATASET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "tetris.h"
+
+//------------------------------------------------------------------------------------
+// Trajectory dataset
+//------------------------------------------------------------------------------------
+//
+// Ticks of batch games for offline learning, as an append-only file of fixed
+// size records (POSIX I/O): a 64 bytes header, "TTDS" version recordSize cols
+// rows as uint32, zero padded, then one TrajectoryRecord per tick, in native
+// byte order. Records of a game are in tick order, but the games of a run
+// are interleaved, in the order their buffers were flushed. A record cut short
+// by a crash at the end of the file is ignored.
+//
+struct TrajectoryRecord {
+    uint16_t rows[Board::maxRows]; // Locked cells before the tick, bit j is column j + 1
+    uint32_t game;                 // Seed of the game
+    uint32_t tick;
+    int32_t  reward;               // Score gained on the tick
+    uint8_t  piece;                // Moving block type before the tick, 0xFF without one
+    uint8_t  rotation;
+    int8_t   x, y;
+    uint8_t  next;                 // Type of the next block
+    uint8_t  actions;              // Played on the tick
+    uint8_t  over;                 // 1 when the game ended on the tick
+    uint8_t  padding;
+
+    // The state of the game before a tick, reward and over are left to 0
+    static TrajectoryRecord capture (const Tetris& game, unsigned actions);
+};
+
+static_assert(std::is_trivially_copyable<TrajectoryRecord>::value && sizeof(TrajectoryRecord) == 84,
+              "Records are written as they are in memory");
+
+class DatasetWriter {
+private:
+    int fd;
+    std::mutex lock;
+    long long written;
+
+public:
+    //
+    // Records of one thread, written to the file in one large sequential
+    // write whenever the buffer is full. The destructor writes what is left
+    // but cannot report a failure, call flush() first to get it.
+    //
+    class Buffer {
+    private:
+        DatasetWriter& writer;
+        std::vector<TrajectoryRecord> records;
+
+    public:
+        static const size_t defaultCapacity = 1 << 14; // About 1.3 MB
+
+        explicit Buffer (DatasetWriter& w, size_t capacity = defaultCapacity);
+        ~Buffer ();
+
+        Buffer (const Buffer&) = delete;
+        Buffer& operator= (const Buffer&) = delete;
+
+        void push (const TrajectoryRecord& record) {
+            records.push_back(record);
+            if (records.size() == records.capacity())
+                flush();
+        }
+        void flush ();
+    };
+
+    // Creates or truncates the file, whose games all have the grid size of
+    // config. Throws std::runtime_error when the file cannot be written.
+    DatasetWriter (const char* path, const GameConfig& config);
+    ~DatasetWriter ();
+
+    DatasetWriter (const DatasetWriter&) = delete;
+    DatasetWriter& operator= (const DatasetWriter&) = delete;
+
+    // Thread safe, the records go at the end of the file. Throws
+    // std::runtime_error when the write fails.
+    void write (const TrajectoryRecord* records, size_t count);
+    long long getRecordsCount () const { return written; }
+};
+
+//
+// Read-only mapping of a dataset file, the records are read in place with no
+// copy and in any order, the system pages them in on demand
+//
+class DatasetReader {
+private:
+    void*  data;
+    size_t length;
+    size_t count;
+    int cols, rows;
+
+public:
+    // Throws std::runtime_error when the file is missing or not a dataset
+    explicit DatasetReader (const char* path);
+    ~DatasetReader ();
+
+    DatasetReader (const DatasetReader&) = delete;
+    DatasetReader& operator= (const DatasetReader&) = delete;
+
+    size_t size () const { return count; }
+    int getCols () const { return cols; }
+    int getRows () const { return rows; }
+
+    const TrajectoryRecord* begin () const;
+    const TrajectoryRecord* end () const { return begin() + count; }
+    const TrajectoryRecord& operator[] (size_t i) const { return begin()[i]; }
+};
+
+#endif /* TETRIS_DATASET_H */
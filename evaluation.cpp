@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "evaluation.h"
+#include "tetris.h"
+
+//------------------------------------------------------------------------------------
+// Lane vectors
+//------------------------------------------------------------------------------------
+// A 32-bit row mask of one board per lane, when the target has vectors
+#if defined(__AVX2__)
+#define EVALUATION_LANES 8
+typedef __m256i Lanes;
+
+static inline Lanes lanesSet (uint32_t x) { return _mm256_set1_epi32(static_cast<int>(x)); }
+static inline Lanes lanesLoad (const uint32_t* p) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(p)); }
+static inline void lanesStore (uint32_t* p, Lanes v) { _mm256_store_si256(reinterpret_cast<__m256i*>(p), v); }
+static inline Lanes lanesAnd (Lanes a, Lanes b) { return _mm256_and_si256(a, b); }
+static inline Lanes lanesOr (Lanes a, Lanes b) { return _mm256_or_si256(a, b); }
+static inline Lanes lanesXor (Lanes a, Lanes b) { return _mm256_xor_si256(a, b); }
+static inline Lanes lanesAndNot (Lanes a, Lanes b) { return _mm256_andnot_si256(a, b); } // ~a & b
+static inline Lanes lanesAdd (Lanes a, Lanes b) { return _mm256_add_epi32(a, b); }
+static inline Lanes lanesSub (Lanes a, Lanes b) { return _mm256_sub_epi32(a, b); }
+static inline Lanes lanesEqual (Lanes a, Lanes b) { return _mm256_cmpeq_epi32(a, b); }
+static inline Lanes lanesShiftLeft (Lanes a, int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+static inline Lanes lanesShiftRight (Lanes a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+#elif defined(__SSE2__)
+#define EVALUATION_LANES 4
+typedef __m128i Lanes;
+
+static inline Lanes lanesSet (uint32_t x) { return _mm_set1_epi32(static_cast<int>(x)); }
+static inline Lanes lanesLoad (const uint32_t* p) { return _mm_load_si128(reinterpret_cast<const __m128i*>(p)); }
+static inline void lanesStore (uint32_t* p, Lanes v) { _mm_store_si128(reinterpret_cast<__m128i*>(p), v); }
+static inline Lanes lanesAnd (Lanes a, Lanes b) { return _mm_and_si128(a, b); }
+static inline Lanes lanesOr (Lanes a, Lanes b) { return _mm_or_si128(a, b); }
+static inline Lanes lanesXor (Lanes a, Lanes b) { return _mm_xor_si128(a, b); }
+static inline Lanes lanesAndNot (Lanes a, Lanes b) { return _mm_andnot_si128(a, b); } // ~a & b
+static inline Lanes lanesAdd (Lanes a, Lanes b) { return _mm_add_epi32(a, b); }
+static inline Lanes lanesSub (Lanes a, Lanes b) { return _mm_sub_epi32(a, b); }
+static inline Lanes lanesEqual (Lanes a, Lanes b) { return _mm_cmpeq_epi32(a, b); }
+static inline Lanes lanesShiftLeft (Lanes a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+static inline Lanes lanesShiftRight (Lanes a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+#elif defined(__ARM_NEON)
+#define EVALUATION_LANES 4
+typedef uint32x4_t Lanes;
+
+static inline Lanes lanesSet (uint32_t x) { return vdupq_n_u32(x); }
+static inline Lanes lanesLoad (const uint32_t* p) { return vld1q_u32(p); }
+static inline void lanesStore (uint32_t* p, Lanes v) { vst1q_u32(p, v); }
+static inline Lanes lanesAnd (Lanes a, Lanes b) { return vandq_u32(a, b); }
+static inline Lanes lanesOr (Lanes a, Lanes b) { return vorrq_u32(a, b); }
+static inline Lanes lanesXor (Lanes a, Lanes b) { return veorq_u32(a, b); }
+static inline Lanes lanesAndNot (Lanes a, Lanes b) { return vbicq_u32(b, a); } // ~a & b
+static inline Lanes lanesAdd (Lanes a, Lanes b) { return vaddq_u32(a, b); }
+static inline Lanes lanesSub (Lanes a, Lanes b) { return vsubq_u32(a, b); }
+static inline Lanes lanesEqual (Lanes a, Lanes b) { return vceqq_u32(a, b); }
+static inline Lanes lanesShiftLeft (Lanes a, int n) { return vshlq_u32(a, vdupq_n_s32(n)); }
+static inline Lanes lanesShiftRight (Lanes a, int n) { return vshlq_u32(a, vdupq_n_s32(-n)); }
+
+static inline Lanes
+lanesPopCount (Lanes a)
+{
+    return vpaddlq_u16(vpaddlq_u8(vcntq_u8(vreinterpretq_u8_u32(a))));
+}
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+// No popcount instruction on x86 vectors below AVX-512, the bit twiddling one
+static inline Lanes
+lanesPopCount (Lanes a)
+{
+    a = lanesSub(a, lanesAnd(lanesShiftRight(a, 1), lanesSet(0x55555555u)));
+    a = lanesAdd(lanesAnd(a, lanesSet(0x33333333u)), lanesAnd(lanesShiftRight(a, 2), lanesSet(0x33333333u)));
+    a = lanesAnd(lanesAdd(a, lanesShiftRight(a, 4)), lanesSet(0x0F0F0F0Fu));
+    a = lanesAdd(a, lanesShiftRight(a, 8));
+    a = lanesAdd(a, lanesShiftRight(a, 16));
+    return lanesAnd(a, lanesSet(0x3F));
+}
+#endif
+
+//------------------------------------------------------------------------------------
+// Features
+//------------------------------------------------------------------------------------
+static void
+sumHeights (BoardFeatures& f, int colsN)
+{
+    for (int j = 0; j < colsN; j++) {
+        f.aggregateHeight += f.heights[j];
+        if (f.heights[j] > f.maxHeight)
+            f.maxHeight = f.heights[j];
+        if (j > 0)
+            f.bumpiness += std::abs(f.heights[j] - f.heights[j - 1]);
+    }
+}
+
+// Cols is the grid width when known at compile time, so the standard grid
+// gets fully unrolled column loops, 0 for any width
+template <int Cols>
+static BoardFeatures
+extractFeatures (const Board& grid)
+{
+    BoardFeatures f = {};
+    const int colsN = Cols > 0 ? Cols : grid.getCols();
+    uint32_t field = grid.fieldMask();
+    // Cells 0..cols, the left wall and the playfield, compared with their right neighbor
+    uint32_t transitionsMask = (2u << colsN) - 1;
+
+    // Rows left once the full ones are removed, then the floor
+    uint32_t rows[Board::maxRows + 1];
+    int n = 0;
+    for (int i = 0; i < grid.getRows(); i++) {
+        if (grid.isRowFull(i))
+            f.completeLines++;
+        else
+            rows[n++] = grid.row(i);
+    }
+    rows[n] = Board::fullRow;
+
+    uint32_t covered = 0;    // Columns with a filled cell in the rows above
+    uint8_t wellRun[Board::maxCols + 2] = {}; // Well cells right above, per column
+
+    for (int k = 0; k < n; k++) {
+        uint32_t row = rows[k], filled = row & field, empty = ~row & field;
+
+        // The first filled cell of a column from the top gives its height
+        for (uint32_t top = filled & ~covered; top; top &= top - 1)
+            f.heights[lowestBit(top) - 1] = n - k;
+        f.holes += popCount(empty & covered);
+        covered |= filled;
+
+        f.rowTransitions += popCount((row ^ (row >> 1)) & transitionsMask);
+        f.columnTransitions += popCount((row ^ rows[k + 1]) & field);
+
+        uint32_t wellCells = empty & (row << 1) & (row >> 1);
+        for (uint32_t bits = field & ~wellCells; bits; bits &= bits - 1)
+            wellRun[lowestBit(bits)] = 0;
+        for (uint32_t bits = wellCells; bits; bits &= bits - 1)
+            f.wells += ++wellRun[lowestBit(bits)];
+    }
+
+    sumHeights(f, colsN);
+    return f;
+}
+
+#ifdef EVALUATION_LANES
+//
+// The features of EVALUATION_LANES boards of the same size at once, one board
+// per lane. Rows are walked from the top like extractFeatures, but a full row
+// is masked off in its lane rather than removed, and the heights and the runs
+// of well cells are bit-sliced counters (plane b holds bit b of the counter of
+// every column), so every step is the same for all the lanes.
+//
+static void
+extractFeaturesLanes (const Board* boards, BoardFeatures* features)
+{
+    const int lanes = EVALUATION_LANES;
+    const int counterBits = 6; // Counters up to maxRows
+    const int rowsN = boards[0].getRows(), colsN = boards[0].getCols();
+
+    alignas(32) uint32_t rows[Board::maxRows][lanes];
+    for (int i = 0; i < rowsN; i++) {
+        for (int b = 0; b < lanes; b++)
+            rows[i][b] = boards[b].row(i);
+    }
+
+    const Lanes zero = lanesSet(0), one = lanesSet(1), ones = lanesSet(~0u);
+    const Lanes field = lanesSet(boards[0].fieldMask());
+    const Lanes fullRow = lanesSet(Board::fullRow);
+    // Cells 0..cols, the left wall and the playfield, compared with their right neighbor
+    const Lanes transitionsMask = lanesSet((2u << colsN) - 1);
+
+    // Rows left once the full ones are removed, a full row compares to -1
+    Lanes remaining = lanesSet(rowsN);
+    for (int i = 0; i < rowsN; i++)
+        remaining = lanesAdd(remaining, lanesEqual(lanesLoad(rows[i]), fullRow));
+    Lanes completeLines = lanesSub(lanesSet(rowsN), remaining);
+
+    Lanes covered = zero;  // Columns with a filled cell in the rows above
+    Lanes previous = zero, hasPrevious = zero; // Last row left above
+    Lanes holes = zero, rowTransitions = zero, columnTransitions = zero, wells = zero;
+    Lanes heights[counterBits], wellRun[counterBits];
+    for (int p = 0; p < counterBits; p++)
+        heights[p] = wellRun[p] = zero;
+
+    for (int i = 0; i < rowsN; i++) {
+        Lanes row = lanesLoad(rows[i]);
+        Lanes kept = lanesAndNot(lanesEqual(row, fullRow), ones);
+        Lanes filled = lanesAnd(row, field), empty = lanesAndNot(row, field);
+
+        // The first filled cell of a column from the top gives its height
+        Lanes top = lanesAnd(lanesAndNot(covered, filled), kept);
+        for (int p = 0; p < counterBits; p++) {
+            Lanes bit = lanesSub(zero, lanesAnd(lanesShiftRight(remaining, p), one));
+            heights[p] = lanesOr(heights[p], lanesAnd(top, bit));
+        }
+        holes = lanesAdd(holes, lanesPopCount(lanesAnd(empty, covered)));
+        covered = lanesOr(covered, lanesAnd(filled, kept));
+
+        // Full rows have no transitions along them
+        Lanes pairs = lanesXor(row, lanesShiftRight(row, 1));
+        rowTransitions = lanesAdd(rowTransitions, lanesPopCount(lanesAnd(pairs, transitionsMask)));
+        Lanes changes = lanesPopCount(lanesAnd(lanesXor(previous, row), field));
+        columnTransitions = lanesAdd(columnTransitions, lanesAnd(changes, lanesAnd(hasPrevious, kept)));
+        previous = lanesOr(lanesAnd(kept, row), lanesAndNot(kept, previous));
+        hasPrevious = lanesOr(hasPrevious, kept);
+
+        // Runs go up by one on the well cells and back to 0 elsewhere
+        Lanes wellCells = lanesAnd(empty, lanesAnd(lanesShiftLeft(row, 1), lanesShiftRight(row, 1)));
+        Lanes carry = wellCells, rowWells = zero;
+        for (int p = 0; p < counterBits; p++) {
+            Lanes next = lanesAnd(lanesXor(wellRun[p], carry), wellCells);
+            carry = lanesAnd(wellRun[p], carry);
+            wellRun[p] = lanesOr(lanesAnd(kept, next), lanesAndNot(kept, wellRun[p]));
+            rowWells = lanesAdd(rowWells, lanesShiftLeft(lanesPopCount(next), p));
+        }
+        wells = lanesAdd(wells, rowWells); // No well cells on full rows
+
+        remaining = lanesAdd(remaining, kept);
+    }
+
+    // The last row left against the floor
+    Lanes changes = lanesPopCount(lanesAnd(lanesXor(previous, fullRow), field));
+    columnTransitions = lanesAdd(columnTransitions, lanesAnd(changes, hasPrevious));
+
+    alignas(32) uint32_t heightPlanes[counterBits][lanes];
+    alignas(32) uint32_t counts[5][lanes];
+    for (int p = 0; p < counterBits; p++)
+        lanesStore(heightPlanes[p], heights[p]);
+    lanesStore(counts[0], holes);
+    lanesStore(counts[1], rowTransitions);
+    lanesStore(counts[2], columnTransitions);
+    lanesStore(counts[3], wells);
+    lanesStore(counts[4], completeLines);
+
+    for (int b = 0; b < lanes; b++) {
+        BoardFeatures& f = features[b];
+        f = BoardFeatures();
+        for (int j = 0; j < colsN; j++) {
+            for (int p = 0; p < counterBits; p++)
+                f.heights[j] |= ((heightPlanes[p][b] >> (j + 1)) & 1) << p;
+        }
+        f.holes = counts[0][b];
+        f.rowTransitions = counts[1][b];
+        f.columnTransitions = counts[2][b];
+        f.wells = counts[3][b];
+        f.completeLines = counts[4][b];
+        sumHeights(f, colsN);
+    }
+}
+#endif
+
+BoardFeatures
+computeFeatures (const Board& grid)
+{
+    return grid.getCols() == gridCols ? extractFeatures<gridCols>(grid) : extractFeatures<0>(grid);
+}
+
+double
+scoreFeatures (const BoardFeatures& f, const FeatureWeights& w)
+{
+    return w.aggregateHeight * f.aggregateHeight +
+           w.holes * f.holes +
+           w.bumpiness * f.bumpiness +
+           w.rowTransitions * f.rowTransitions +
+           w.columnTransitions * f.columnTransitions +
+           w.wells * f.wells +
+           w.completeLines * f.completeLines;
+}
+
+void
+computeFeatures (const Board* boards, int count, BoardFeatures* features)
+{
+    int b = 0;
+#ifdef EVALUATION_LANES
+    // Groups of boards of one size go through the vector kernel, the others one by one
+    for (; b + EVALUATION_LANES <= count; b += EVALUATION_LANES) {
+        bool sameSize = true;
+        for (int k = 1; k < EVALUATION_LANES; k++) {
+            sameSize = sameSize && boards[b + k].getCols() == boards[b].getCols() &&
+                                   boards[b + k].getRows() == boards[b].getRows();
+        }
+        if (sameSize)
+            extractFeaturesLanes(boards + b, features + b);
+        else {
+            for (int k = 0; k < EVALUATION_LANES; k++)
+                features[b + k] = computeFeatures(boards[b + k]);
+        }
+    }
+#endif
+    for (; b < count; b++)
+        features[b] = computeFeatures(boards[b]);
+}
+
+void
+scoreBoards (const Board* boards, int count, const FeatureWeights& weights, double* scores)
+{
+    static const int chunk = 64;
+    BoardFeatures features[chunk];
+
+    for (int b = 0; b < count; b += chunk) {
+        int n = std::min(chunk, count - b);
+        computeFeatures(boards + b, n, features);
+        for (int k = 0; k < n; k++)
+            scores[b + k] = scoreFeatures(features[k], weights);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef TETRIS_EVALUATION_H
+#define TETRIS_EVALUATION_H
+
+#include "board.h"
+
+//
+// Classic board evaluation features for heuristic agents, computed from the
+// Board bitboard: every row is one 32-bit word, so each feature is a few
+// shifts, ANDs and popcounts per row for all the columns at once, instead of
+// a loop over the cells.
+//
+// Full rows are skipped, the features describe the board as it will be once
+// they are removed, and completeLines counts them.
+//
+struct BoardFeatures {
+    int heights[Board::maxCols]; // Column heights from the floor, leftmost column first
+    int aggregateHeight;         // Sum of the heights
+    int maxHeight;
+    int holes;                   // Empty cells with a filled cell above them
+    int bumpiness;               // Sum of the height differences of neighbor columns
+    int rowTransitions;          // Filled/empty changes along the rows, walls included
+    int columnTransitions;       // Filled/empty changes down the columns, floor included
+    int wells;                   // Empty cells between two filled neighbors, a cell
+                                 // counting 1 + the well cells right above it
+    int completeLines;
+};
+
+// Weights of a linear evaluation, higher scores are better boards
+struct FeatureWeights {
+    double aggregateHeight;
+    double holes;
+    double bumpiness;
+    double rowTransitions;
+    double columnTransitions;
+    double wells;
+    double completeLines;
+
+    // Tuned weights of the well known four features evaluation
+    // (aggregate height, holes, bumpiness, complete lines)
+    static FeatureWeights defaults () { return { -0.510066, -0.35663, -0.184483, 0, 0, 0, 0.760666 }; }
+};
+
+BoardFeatures computeFeatures (const Board& grid);
+double scoreFeatures (const BoardFeatures& features, const FeatureWeights& weights);
+
+// Batch versions over arrays of count boards, the results go to the same index.
+// With SSE2, AVX2 or NEON they run 4 or 8 boards of the same size at once, one
+// per vector lane, and give the same features as the single board version.
+void computeFeatures (const Board* boards, int count, BoardFeatures* features);
+void scoreBoards (const Board* boards, int count, const FeatureWeights& weights, double* scores);
+
+#endif /* TETRIS_EVALUATION_H */
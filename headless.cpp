@@ -0,0 +1,336 @@
+//
+// Headless self-play driver. It runs independent games of the Tetris core on
+// every core of the machine, with no window, then prints a compact report.
+// It also dumps every tick of the run to a trajectory dataset for offline
+// learning, records a single game to a replay file, plays replays back at full
+// simulation speed, and plays versus matches between bots, one thread each, or
+// against another tetris-headless over the network.
+//
+// Usage: tetris-headless [-n games] [-j threads] [-s seed] [-t max ticks] [-b] [-g] [-T size] [-v]
+//                        [-W cols] [-H rows] [-l level] [-r replay to record] [-p replay to play]
+//                        [-V players] [-L port to host on] [-C host:port to join]
+//                        [-D dataset to write] [-d dataset to read]
+//
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "batch.h"
+#include "netplay.h"
+#include "replay.h"
+#include "versus.h"
+
+static void
+usage (const char* name)
+{
+    std::cout << "Usage: " << name << " [-n games] [-j threads] [-s seed] [-t max ticks] [-b] [-g] [-T size] [-v]\n"
+              << "         [-W cols] [-H rows] [-l level] [-r replay to record] [-p replay to play]\n"
+              << "         [-V players] [-L port to host on] [-C host:port to join]\n"
+              << "         [-D dataset to write] [-d dataset to read]\n"
+              << "  -n  number of games (default 100)\n"
+              << "  -j  worker threads, 0 for one per core (default 0)\n"
+              << "  -s  seed of the first game, game i uses seed + i (default 1)\n"
+              << "  -t  ticks after which a game is stopped (default 100000)\n"
+              << "  -b  deal blocks from a 7-bag instead of uniformly\n"
+              << "  -g  play with the greedy placement agent instead of random keys\n"
+              << "  -T  greedy agents share a transposition table of 2^size board scores\n"
+              << "  -v  print the result of every game as CSV\n"
+              << "  -W  grid columns, 4 to " << Board::maxCols << " (default " << gridCols << ")\n"
+              << "  -H  grid rows, 4 to " << Board::maxRows << " (default " << gridRows << ")\n"
+              << "  -l  start level, the last one " << GameConfig::maxLevels - 1 << " is 20G (default 0)\n"
+              << "  -r  play a single game with the first seed and save its replay\n"
+              << "  -p  play a replay up to the -t tick, or to its end\n"
+              << "  -V  play a versus match between 2 to " << VersusMatch::maxPlayers << " bots, cleared rows\n"
+              << "      send garbage to the opponents, a draw after -t ticks\n"
+              << "  -L  host a versus game over UDP in real time, the game settings are sent to the peer\n"
+              << "  -C  join a versus game hosted over UDP\n"
+              << "  -D  write a record of every tick of the games to a dataset file\n"
+              << "  -d  print a summary of a dataset file" << std::endl;
+}
+
+static void
+printGame (const Tetris& game)
+{
+    static const char cells[] = { '.', '@', '#', '|', '=' }; // Indexed by BlockState
+
+    for (int i = 0; i < game.getRows() + 1; i++) {
+        for (int j = 0; j < game.getCols() + 2; j++)
+            std::cout << cells[game.cellState(i, j)];
+        std::cout << '\n';
+    }
+    std::cout << "seed: " << game.getSeed()
+              << ", ticks: " << game.getTicksCount()
+              << ", score: " << game.getScore()
+              << ", lines: " << game.getLinesCleared()
+              << ", pieces: " << game.getPiecesCount()
+              << (game.isGameOver() ? ", game over" : "") << std::endl;
+}
+
+// Scores shared by every greedy agent of the run, whatever its thread, with -T
+static std::unique_ptr<TranspositionTable> greedyScores;
+
+static std::unique_ptr<Agent>
+makeAgent (bool greedy, uint32_t seed)
+{
+    if (greedy)
+        return std::unique_ptr<Agent>(new GreedyAgent(FeatureWeights::defaults(), greedyScores.get()));
+    return std::unique_ptr<Agent>(new RandomAgent(seed));
+}
+
+static void
+recordGame (const BatchOptions& options, bool greedy, const char* path)
+{
+    Tetris game(options.config, options.seed);
+    std::unique_ptr<Agent> agent = makeAgent(greedy, options.seed);
+    ReplayRecorder recorder(ReplayHeader::fromGame(game));
+
+    while (!game.isGameOver() && game.getTicksCount() < options.maxTicks) {
+        unsigned actions = agent->act(game);
+        recorder.record(actions);
+        game.update(actions);
+    }
+
+    recorder.save(path);
+    printGame(game);
+}
+
+static void
+playVersus (const BatchOptions& options, bool greedy, int players)
+{
+    VersusOptions versus;
+    versus.players = players;
+    versus.seed = options.seed;
+    versus.maxTicks = options.maxTicks;
+    versus.config = options.config;
+
+    VersusMatch match(versus, [greedy] (int, uint32_t seed) {
+        return makeAgent(greedy, seed);
+    });
+    match.start();
+    match.wait();
+    match.report().print(std::cout);
+}
+
+static void
+playNetplay (const BatchOptions& options, bool greedy, const char* host, int port)
+{
+    RollbackOptions rollback;
+    rollback.seed = options.seed;
+    rollback.config = options.config;
+
+    std::unique_ptr<NetSession> net(host != nullptr ? new NetSession(host, port) : new NetSession(port, rollback));
+    if (host != nullptr)
+        std::cout << "Joining " << host << ':' << port << std::endl;
+    else
+        std::cout << "Waiting on port " << port << std::endl;
+
+    std::unique_ptr<Agent> agent;
+    auto start = std::chrono::steady_clock::now();
+    auto nextTick = start;
+    long lingerTicks = 0;
+
+    // Real time, the peer plays at the same speed
+    for (;;) {
+        nextTick += std::chrono::nanoseconds(1000000000 / ticksPerSecond);
+        std::this_thread::sleep_until(nextTick);
+
+        if (!net->isConnected()) {
+            net->poll();
+            start = nextTick;
+            continue;
+        }
+        if (net->isConnectionLost())
+            throw std::runtime_error("Connection lost");
+
+        const RollbackSession& session = net->getSession();
+        const Tetris& game = session.getGame(session.getLocalPlayer());
+        if (agent == nullptr)
+            agent = makeAgent(greedy, game.getSeed());
+
+        net->tick(agent->act(game));
+
+        // Keep sending a second after the end, so the peer gets the last inputs
+        if ((session.isOver() || game.getTicksCount() >= options.maxTicks) && ++lingerTicks > ticksPerSecond)
+            break;
+    }
+
+    const RollbackSession& session = net->getSession();
+    for (int p = 0; p < 2; p++) {
+        std::cout << "player " << p << (p == session.getLocalPlayer() ? " (local)" : "") << '\n';
+        printGame(session.getGame(p));
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    int winner = session.getWinner();
+    std::cout << (winner >= 0 ? "winner: player " + std::to_string(winner) : std::string("draw"))
+              << ", ticks: " << session.getTicks()
+              << ", resimulated: " << session.getResimulatedTicks()
+              << ", sent: " << net->getBytesSent() / elapsed.count() << " B/s"
+              << ", received: " << net->getBytesReceived() / elapsed.count() << " B/s" << std::endl;
+}
+
+static void
+printDataset (const char* path)
+{
+    DatasetReader dataset(path);
+
+    long long reward = 0;
+    long games = 0;
+    for (const TrajectoryRecord& record : dataset) {
+        reward += record.reward;
+        games += record.over;
+    }
+
+    std::cout << "records: " << dataset.size()
+              << ", grid: " << dataset.getCols() << 'x' << dataset.getRows()
+              << ", games over: " << games
+              << ", reward: " << reward << std::endl;
+}
+
+static void
+playReplay (const char* path, long tick)
+{
+    ReplayPlayer player(path);
+    Tetris game = player.getHeader().createGame();
+
+    player.seek(game, tick < 0 ? player.getTicks() : tick);
+    printGame(game);
+}
+
+int
+main (int argc, char* argv[])
+{
+    BatchOptions options;
+    int threadsCount = 0;
+    bool perGame = false, hasMaxTicks = false, greedy = false;
+    const char* recordPath = nullptr;
+    const char* playPath = nullptr;
+    const char* datasetPath = nullptr;
+    const char* readPath = nullptr;
+    int versusPlayers = 0;
+    int netPort = 0;
+    int tableSize = 0;
+    std::string joinHost;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+
+        if (!std::strcmp(argv[i], "-n") && hasValue)
+            options.games = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-j") && hasValue)
+            threadsCount = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-s") && hasValue)
+            options.seed = std::strtoul(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "-t") && hasValue) {
+            options.maxTicks = std::atol(argv[++i]);
+            hasMaxTicks = true;
+        }
+        else if (!std::strcmp(argv[i], "-b"))
+            options.config.randomizer = RANDOMIZER_BAG;
+        else if (!std::strcmp(argv[i], "-g"))
+            greedy = true;
+        else if (!std::strcmp(argv[i], "-T") && hasValue)
+            tableSize = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-v"))
+            perGame = true;
+        else if (!std::strcmp(argv[i], "-W") && hasValue)
+            options.config.cols = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-H") && hasValue)
+            options.config.rows = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-l") && hasValue)
+            options.config.startLevel = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-r") && hasValue)
+            recordPath = argv[++i];
+        else if (!std::strcmp(argv[i], "-p") && hasValue)
+            playPath = argv[++i];
+        else if (!std::strcmp(argv[i], "-D") && hasValue)
+            datasetPath = argv[++i];
+        else if (!std::strcmp(argv[i], "-d") && hasValue)
+            readPath = argv[++i];
+        else if (!std::strcmp(argv[i], "-V") && hasValue)
+            versusPlayers = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-L") && hasValue)
+            netPort = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-C") && hasValue) {
+            joinHost = argv[++i];
+            size_t colon = joinHost.rfind(':');
+            if (colon == std::string::npos) {
+                usage(argv[0]);
+                return 1;
+            }
+            netPort = std::atoi(joinHost.c_str() + colon + 1);
+            joinHost.resize(colon);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    try {
+        options.config.validate();
+        if (tableSize < 0 || tableSize > 30)
+            throw std::runtime_error("Unsupported transposition table size");
+        if (tableSize > 0)
+            greedyScores.reset(new TranspositionTable(tableSize));
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    if (readPath != nullptr || playPath != nullptr || recordPath != nullptr || versusPlayers != 0 || netPort != 0) {
+        try {
+            if (readPath != nullptr)
+                printDataset(readPath);
+            else if (playPath != nullptr)
+                playReplay(playPath, hasMaxTicks ? options.maxTicks : -1);
+            else if (recordPath != nullptr)
+                recordGame(options, greedy, recordPath);
+            else if (netPort != 0)
+                playNetplay(options, greedy, joinHost.empty() ? nullptr : joinHost.c_str(), netPort);
+            else
+                playVersus(options, greedy, versusPlayers);
+        }
+        catch (const std::exception& e) {
+            std::cout << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    std::unique_ptr<DatasetWriter> dataset;
+    try {
+        if (datasetPath != nullptr)
+            dataset.reset(new DatasetWriter(datasetPath, options.config));
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    options.dataset = dataset.get();
+
+    BatchRunner runner(threadsCount);
+    BatchReport report;
+    try {
+        report = runner.run(options, [greedy] (uint32_t seed) {
+            return makeAgent(greedy, seed);
+        });
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    report.print(std::cout, perGame);
+    std::cout << "threads: " << runner.threadsCount() << std::endl;
+    if (dataset != nullptr)
+        std::cout << "records: " << dataset->getRecordsCount() << " written to " << datasetPath << std::endl;
+
+    return 0;
+}
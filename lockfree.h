@@ -0,0 +1,91 @@
+#ifndef TETRIS_LOCKFREE_H
+#define TETRIS_LOCKFREE_H
+
+#include <atomic>
+#include <cstdint>
+
+//
+// Bounded queue between one producer thread and one consumer thread, with no
+// lock: each side owns one index and only reads the other one, so a push or a
+// pop is a couple of atomic loads and one release store.
+//
+template <typename T, int Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity is a power of 2");
+
+private:
+    // Indices count every item ever pushed or popped, kept on separate cache lines
+    std::atomic<uint32_t> head; // Next item to pop, written by the consumer
+    char padding[64];
+    std::atomic<uint32_t> tail; // Next slot to push, written by the producer
+    char tailPadding[64];
+    T items[Capacity];
+
+public:
+    SpscQueue () : head(0), tail(0) {}
+
+    SpscQueue (const SpscQueue&) = delete;
+    SpscQueue& operator= (const SpscQueue&) = delete;
+
+    // Producer side, false when the queue is full
+    bool push (const T& item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        items[t & (Capacity - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false when the queue is empty
+    bool pop (T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = items[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+//
+// Latest value published by one writer thread to one reader thread. The
+// writer fills its back buffer and swaps it with the middle one, the reader
+// swaps the middle one with its front buffer when a new value is there, so
+// neither side ever waits and the reader always gets a complete value.
+//
+template <typename T>
+class TripleBuffer {
+private:
+    static const uint8_t freshBit = 4; // Set in middle when the writer published since the last read
+
+    T buffers[3];
+    std::atomic<uint8_t> middle;
+    uint8_t back;  // Owned by the writer
+    uint8_t front; // Owned by the reader
+
+public:
+    TripleBuffer () : buffers(), middle(1), back(2), front(0) {}
+
+    TripleBuffer (const TripleBuffer&) = delete;
+    TripleBuffer& operator= (const TripleBuffer&) = delete;
+
+    // Writer side, fill the buffer then publish it
+    T& writeBuffer () { return buffers[back]; }
+    void publish () {
+        back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & 3;
+    }
+
+    // Reader side, true when a newer value replaced the one read before
+    bool update () {
+        if (!(middle.load(std::memory_order_relaxed) & freshBit))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+    const T& read () const { return buffers[front]; }
+};
+
+#endif /* TETRIS_LOCKFREE_H */
@@ -6,159 +6,220 @@
     #include <SDL2/SDL_ttf.h>
 #endif /* __APPLE__ */
 
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <iostream>
-#include <cmath>
-#include <vector>
-#include <array>
+#include <limits>
+#include <memory>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
-#define MAX_KEYBOARD_KEYS 350
+#include "font_data.h"
+#include "lockfree.h"
+#include "netplay.h"
+#include "profiler.h"
+#include "replay.h"
+#include "tetris.h"
+#include "versus.h"
 
 //------------------------------------------------------------------------------------
 // Constants Definition
 //------------------------------------------------------------------------------------
-// Window
+// Window, the smallest size, it grows with the grid
 static const int screenWidth = 600;
 static const int screenHeight = 480;
 
-// Font
-static const std::string defaultFontPath = "assets/fonts/Pixel.ttf";
+// Font, assets/fonts/Pixel.ttf embedded by the Makefile in font_data.h
+static const unsigned char* const fontData = Pixel_ttf;
+static const int fontDataSize = static_cast<int>(Pixel_ttf_len);
+static const int gameOverFontSize = 24;
+static const int otherFontSize = 12;
 
 // Square size (could be computed based on the screen size if we want to)
 static const int squareSize = 20;
-// Grid sized according to google
-static const int gridCols = 10;
-static const int gridRows = 20;
-
 // Grid position x,y
 static const int gridPosX = 120;
 static const int gridPosY = 30;
-// Next block preview
+// Next block preview, blocks are stacked one every previewStep pixels
 static const int nextBlockPreviewDistance = 50;
+static const int previewStep = squareSize * 5;
+// Boards of the versus opponents, smaller cells side by side right of the preview
+static const int opponentSquareSize = 8;
+static const int opponentsGap = 20;
+// Versus bots only act every this many ticks, to play at a human speed
+static const int botPace = 6;
 
-// Game speed (lower is faster)
-static const int gravitySpeed = 30;
-static const int lateralSpeed = 8;
-static const int rotatingSpeed = 8;
-static const int fadingTime = 50;
-static const int speedyGravityDelay = 40;
-
-//------------------------------------------------------------------------------------
-// Data
-//------------------------------------------------------------------------------------
-enum BlockState { EMPTY, MOVING, BLOCK, WALL, FADING };
-
-enum BlockType { I, O, T, S, Z, J, L, BLOCKTYPE_COUNT };
-
-std::vector<std::vector<std::vector<int> > > blockShapes = {
-    { // I
-        {0, 0, 0, 0},
-        {1, 1, 1, 1},
-        {0, 0, 0, 0},
-        {0, 0, 0, 0},
-    },
-    { // O
-        {0, 0, 0, 0},
-        {0, 1, 1, 0},
-        {0, 1, 1, 0},
-        {0, 0, 0, 0},
-    },
-    { // T
-        {0, 0, 0, 0},
-        {0, 1, 1, 1},
-        {0, 0, 1, 0},
-        {0, 0, 0, 0},
-    },
-    { // S
-        {0, 0, 0, 0},
-        {0, 0, 1, 1},
-        {0, 1, 1, 0},
-        {0, 0, 0, 0},
-    },
-    { // Z
-        {0, 0, 0, 0},
-        {0, 1, 1, 0},
-        {0, 0, 1, 1},
-        {0, 0, 0, 0},
-    },
-    { // J
-        {0, 0, 0, 0},
-        {0, 1, 1, 1},
-        {0, 1, 0, 0},
-        {0, 0, 0, 0},
-    },
-    { // L
-        {0, 0, 0, 0},
-        {0, 1, 1, 1},
-        {0, 0, 0, 1},
-        {0, 0, 0, 0},
-    },
-};
-
-//------------------------------------------------------------------------------------
-// Utils
-//------------------------------------------------------------------------------------
-int
-randomNumber (int min, int max)
-{
-    std::random_device rd;  // Random device engine, to generate a seed
-    std::mt19937 mt(rd());  // Initialize Mersenne Twister pseudo-random number generator
-    std::uniform_int_distribution<int> dist(min, max);  // Uniform distribution between min and max
-    return dist(mt);  // Generate and return a random number
-}
+// Most ticks simulated in one step of the simulation thread, after a long
+// stall the game slows down instead of trying to catch up all at once
+static const int maxTicksPerStep = 10;
 
 //------------------------------------------------------------------------------------
 // Classes
 //------------------------------------------------------------------------------------
-// Class that simply keep tracking of each pressed key into a boolean vector.
+//
+// Keeps track of the pressed keys. Key events are queued with their SDL
+// timestamp and applied tick by tick, so when a frame runs several ticks each
+// one sees the keys as they were at its own time. A key pressed and released
+// before its tick ran still counts as pressed on that tick, so taps are never
+// lost.
+//
 class InputManager {
 private:
-    std::vector<bool> keymap;
+    struct KeyEvent {
+        Uint32 timestamp;
+        SDL_Scancode code;
+        bool down;
+    };
+
+    static const int maxQueuedEvents = 64;
+
+    std::bitset<SDL_NUM_SCANCODES> keymap;
+    std::bitset<SDL_NUM_SCANCODES> tapped; // Pressed since the last tick
+    KeyEvent events[maxQueuedEvents];
+    int eventsHead, eventsCount;
+
+    // Dequeue the oldest event, a press stays tapped until the next tick
+    void applyOldest ()
+    {
+        const KeyEvent& event = events[eventsHead];
+        keymap[event.code] = event.down;
+        if (event.down)
+            tapped[event.code] = true;
+
+        eventsHead = (eventsHead + 1) % maxQueuedEvents;
+        eventsCount--;
+    }
 
 public:
-    InputManager() : keymap(MAX_KEYBOARD_KEYS, false) {}
+    InputManager () : eventsHead(0), eventsCount(0) {}
 
-    void handlerInput (SDL_Event event)
+    void handlerInput (const SDL_Event& event)
     {
-        if (event.type == SDL_KEYDOWN) {
-            keymap[event.key.keysym.scancode] = true;
-        }
-        else if (event.type == SDL_KEYUP) {
-            keymap[event.key.keysym.scancode] = false;
-        }
+        // Key repeats are handled by the game (auto shift), only real presses count
+        if ((event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) || event.key.repeat)
+            return;
+        if (event.key.keysym.scancode >= SDL_NUM_SCANCODES)
+            return;
+
+        // Queue full, the oldest event takes effect early: only its timing is
+        // lost, a press still counts on the next tick
+        if (eventsCount == maxQueuedEvents)
+            applyOldest();
+
+        KeyEvent& queued = events[(eventsHead + eventsCount) % maxQueuedEvents];
+        queued = { event.key.timestamp, event.key.keysym.scancode, event.type == SDL_KEYDOWN };
+        eventsCount++;
+    }
+
+    // Apply the events up to the given time, called once per tick before reading keys
+    void advance (Uint32 time)
+    {
+        tapped.reset();
+        while (eventsCount > 0 && !SDL_TICKS_PASSED(events[eventsHead].timestamp, time + 1))
+            applyOldest();
     }
 
-    bool isKeyPressed (SDL_Scancode code) { return keymap[code]; }
+    bool isKeyPressed (SDL_Scancode code) const { return keymap[code] || tapped[code]; }
+};
+
+// Versus opponent, the greedy bot slowed down to a move every few ticks
+class PacedAgent : public Agent {
+private:
+    GreedyAgent bot;
+
+public:
+    unsigned act (const Tetris& game) override {
+        if (game.getTicksCount() % botPace != 0)
+            return ACTION_NONE;
+        return bot.act(game);
+    }
 };
 
+// Renders text with a TTF font. Rendered strings are kept as textures and
+// reused while the same text is drawn again, so constant labels and a score
+// that rarely changes cost one texture copy per frame.
 class FontManager {
 private:
+    struct CachedText {
+        std::string text;
+        SDL_Color color;
+        SDL_Renderer* renderer;
+        SDL_Texture* texture;
+        int w, h;
+        unsigned long lastUse;
+    };
+
+    static const int cacheSize = 16;
+
     TTF_Font* font;
+    CachedText cache[cacheSize];
+    unsigned long useCounter;
+
+    CachedText& findText (SDL_Renderer* renderer, const char* text, SDL_Color color);
 
 public:
-    FontManager (const char* fontPath, int size) {
+    // Opens the TTF font in memory, data must stay valid until the font is closed
+    FontManager (const void* data, int dataSize, int size) : cache(), useCounter(0) {
+        // SDL_ttf is only started with the first font
+        if (!TTF_WasInit() && TTF_Init() < 0) {
+            std::cout << TTF_GetError() << std::endl;
+            throw std::runtime_error("Failed to initialize SDL_ttf");
+        }
+
         // Font opening requires a size, which cannot be changed afterwards.
         // So to have multiple text size rendering, you need to create 
         // multiple FontManager objects, each with a different size.
-        font = TTF_OpenFont(fontPath, size);
+        font = TTF_OpenFontRW(SDL_RWFromConstMem(data, dataSize), 1, size);
         if (!font) {
             std::cout << TTF_GetError() << std::endl;
             throw std::runtime_error("Failed to load font");
         }
     }
 
-    ~FontManager () { TTF_CloseFont(font); }
+    ~FontManager ();
 
-    void drawText (SDL_Renderer* renderer, char* text, int x, int y) { 
+    void drawText (SDL_Renderer* renderer, const char* text, int x, int y) { 
         drawText(renderer, text, {0, 0, 0, 255}, x, y); 
     }
-    void drawText (SDL_Renderer* renderer, char* text, SDL_Color color, int x, int y);
+    void drawText (SDL_Renderer* renderer, const char* text, SDL_Color color, int x, int y);
 };
 
-void
-FontManager::drawText (SDL_Renderer* renderer, char* text, SDL_Color color, int x, int y)
+FontManager::~FontManager ()
 {
+    for (auto& entry : cache) {
+        if (entry.texture != nullptr)
+            SDL_DestroyTexture(entry.texture);
+    }
+    TTF_CloseFont(font);
+}
+
+FontManager::CachedText&
+FontManager::findText (SDL_Renderer* renderer, const char* text, SDL_Color color)
+{
+    CachedText* oldest = &cache[0];
+
+    for (auto& entry : cache) {
+        if (entry.texture != nullptr && entry.renderer == renderer &&
+            entry.color.r == color.r && entry.color.g == color.g &&
+            entry.color.b == color.b && entry.color.a == color.a &&
+            entry.text == text) {
+            entry.lastUse = ++useCounter;
+            return entry;
+        }
+        if (entry.lastUse < oldest->lastUse)
+            oldest = &entry;
+    }
+
+    // Not cached, render it in place of the least recently used entry
     SDL_Surface* surface = TTF_RenderText_Solid(font, text, color);
     if (surface == nullptr) {
         throw std::runtime_error("Failed to create text surface");
@@ -170,488 +231,652 @@ FontManager::drawText (SDL_Renderer* renderer, char* text, SDL_Color color, int
         throw std::runtime_error("Failed to create text texture");
     }
 
-    SDL_Rect dstrect = { x, y, surface->w, surface->h };
-    SDL_RenderCopy(renderer, texture, NULL, &dstrect);
+    if (oldest->texture != nullptr)
+        SDL_DestroyTexture(oldest->texture);
 
-    SDL_FreeSurface(surface);
-    SDL_DestroyTexture(texture);
-}
+    oldest->text = text;
+    oldest->color = color;
+    oldest->renderer = renderer;
+    oldest->texture = texture;
+    oldest->w = surface->w;
+    oldest->h = surface->h;
+    oldest->lastUse = ++useCounter;
 
-class Block {
-public:
-    BlockType type;
-    std::vector<std::vector<int> > shape;
-    int posX, posY;
-
-    Block (BlockType t);
-
-    void setPosition (int x, int y) { posX = x; posY = y; }
-    void rotate () { shape = rotationPreview(); }
-    void moveDown () { posY++; };
-    void moveLeft () { posX--; };
-    void moveRight () { posX++; };
-    std::vector<std::vector<int> > rotationPreview ();
-};
-
-Block::Block (BlockType t)
-{
-    int idx = static_cast<int>(t);
-    type = t;
-    shape = blockShapes[idx];
-    posX = 0;
-    posY = 0;
+    SDL_FreeSurface(surface);
+    return *oldest;
 }
 
-std::vector<std::vector<int> >
-Block::rotationPreview ()
+void
+FontManager::drawText (SDL_Renderer* renderer, const char* text, SDL_Color color, int x, int y)
 {
-    // Avoid rotating O shape
-    if (type == O) return shape;
+    PROFILE_SCOPE(ZONE_TEXT);
+    CachedText& entry = findText(renderer, text, color);
 
-    int n = shape.size();
-    std::vector<std::vector<int>> rotated(n, std::vector<int>(n, 0));
-
-    for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < n; ++j) {
-            rotated[j][n - i - 1] = shape[i][j];  // Rotate vector
-        }
-    }
-
-    return rotated;
+    SDL_Rect dstrect = { x, y, entry.w, entry.h };
+    SDL_RenderCopy(renderer, entry.texture, NULL, &dstrect);
 }
 
+// Everything drawn from the games, published by the simulation thread after its ticks
+struct FrameSnapshot {
+    static const int maxOpponents = VersusMatch::maxPlayers - 1;
+
+    GameConfig config;   // The online host's one when joining
+    GameState  game;
+    GameState  opponents[maxOpponents];
+    int  opponentsCount;
+    const char* overText; // Message of the game over screen, null while playing
+    bool waiting;         // Online game waiting for the other player
+    long ticks;           // Ticks run since the start
+};
+
 //
-// To keep track of the current moving block and the game grid, we use
-// two different matrixes. The grid is default to 10x20, while the matrix
-// for the moving block is a 4x4. 
-// The movingBlock object keeps track of the matrix, plus the position of the block
-// in the grid (x,y). To do collision detection, we iterate over
-// the block matrix, adding the position and checking if in the grid matrix,
-// the cell is EMPTY or is a WALL/BLOCK and in case, is a collision.
+// SDL front end of the game. It drives the Tetris core on a simulation thread,
+// mapping held keys on actions, while the main thread pumps the SDL events
+// and draws. Key events go to the simulation through an SPSC queue, and the
+// games come back as a FrameSnapshot through a triple buffer, so a slow
+// present (vsync, driver stalls) never delays a tick and neither thread waits
+// for the other.
 //
-class Tetris {
+class TetrisApp {
 private:
-    // Game
-    bool gameOver;
-    int  score;
-    int  gravityMovementCounter;
-    int  lateralMovementCounter;
-    int  rotatingMovementCounter;
-    int  speedyGravityMovementCounter;
-    int  rowsFadingCounter;
+    enum Batch { BATCH_EMPTY, BATCH_WALL, BATCH_FADING, BATCH_BLOCK, BATCH_COUNT };
 
-    std::vector<int> rowsToDelete; 
+    // Simulation thread, the members down to net only belong to it once started
+    std::thread simulation;
+    std::atomic<bool> stopping;
+    bool unthrottled;
+    SpscQueue<SDL_Event, 256> events;
+    TripleBuffer<FrameSnapshot> frames;
+    long ticksCount;
 
+    Tetris game;
     InputManager inputManager;
-    FontManager* gameOverFont;
-    FontManager* otherFont;
 
-    // Grid
-    std::vector< std::vector<int> > grid;
-    int colsN, rowsN;
-
-    // Blocks
-    std::unique_ptr<Block> movingBlock;
-    std::unique_ptr<Block> nextBlock;
-
-    std::unique_ptr<Block> createRandomBlock ();
-    void setNewBlocks ();
-    void clearGrid (bool fullClean = false);
-    void initialize ();
-    void addCurrentBlockToGrid (bool addAsBlock);
-    bool solveVerticalCollision ();
-    void solveHorizontalCollision ();
-    void solveRotationCollision ();
-    void checkCompletedRows ();
-    void checkGameOver ();
-    void removeCompletedRows ();
-
-public:
-    Tetris (int cols, int rows, const char* fontPath);
-    ~Tetris () { delete gameOverFont; delete otherFont; };
-
-    void update ();
-    void draw (SDL_Renderer* renderer);
-    void handleInput (SDL_Event event) { inputManager.handlerInput(event); }
-};
+    // Replay of the current game, when recording
+    const char* recordPath;
+    std::unique_ptr<ReplayRecorder> recorder;
+    int recordedGames;
 
-Tetris::Tetris (int cols, int rows, const char* fontPath)
-{
-    colsN = cols; rowsN = rows;
-    gameOverFont = new FontManager(fontPath, 24);
-    otherFont = new FontManager(fontPath, 12);
-    initialize();
-}
+    // Versus mode, the player's game runs in the match and game only shows its
+    // snapshots, like opponents for the bots
+    std::unique_ptr<VersusMatch> match;
+    std::vector<Tetris> opponents;
+    // Netplay, both games run in the rollback session and are copied from it
+    std::unique_ptr<NetSession> net;
 
-void
-Tetris::update ()
-{
-    if (gameOver) {
-        if (inputManager.isKeyPressed(SDL_SCANCODE_RETURN))
-            initialize();
-        else
-            return;
+    // Render thread, the games of the last snapshot
+    FontManager* gameOverFont; // Only opened on the first game over
+    FontManager* otherFont;
+    Tetris shownGame;
+    std::vector<Tetris> shownOpponents;
+    const char* overText;
+    bool waiting;
+    long shownTicks;
+
+    // Rectangles of the cells drawn with the same color, kept between frames
+    std::vector<SDL_Rect> boardBatches[BATCH_COUNT];
+    std::vector<SDL_Rect> blocksBatch;
+    std::vector<SDL_Rect> previewEmptyBatch;
+    std::vector<SDL_Rect> ghostBatch; // Outline of where the moving block would land
+    std::vector<SDL_Rect> opponentsBatch;
+    std::vector<SDL_Rect> opponentsWallBatch;
+
+    // Simulation thread
+    void simulate ();
+    // Run one tick, with the keys as they were at the given time (SDL_GetTicks)
+    void update (Uint32 time);
+    void publish ();
+    void startMatch (uint32_t seed);
+    bool isOver () const;
+    const char* getOverText () const;
+
+    // Render thread
+    void refresh ();
+    void rebuildBoardBatches ();
+    void drawOpponents (SDL_Renderer* renderer, int x);
+
+#ifdef TETRIS_PROFILE
+    bool showProfile; // Frame time overlay, toggled with F3
+
+    void drawProfile (SDL_Renderer* renderer);
+    // Write the frames in the profiler buffer, on F4
+    void saveProfile ();
+#endif /* TETRIS_PROFILE */
+
+    static SDL_Rect cellRect (int x, int y, int i, int j) {
+        return { x + squareSize * j, y + squareSize * i, squareSize, squareSize };
     }
-
-    if (!rowsToDelete.empty()) {
-        // Increment fading counter for fading effect
-        rowsFadingCounter++;
-
-        if (rowsFadingCounter >= fadingTime) {
-            removeCompletedRows();
-
-            rowsFadingCounter = 0;
-            rowsToDelete.clear();
-        }
-        return;
+    static void drawRects (SDL_Renderer* renderer, const std::vector<SDL_Rect>& rects, bool filled) {
+        if (rects.empty())
+            return;
+        if (filled)
+            SDL_RenderFillRects(renderer, rects.data(), static_cast<int>(rects.size()));
+        else
+            SDL_RenderDrawRects(renderer, rects.data(), static_cast<int>(rects.size()));
     }
 
-    if (movingBlock == nullptr)
-        setNewBlocks(); // Create a new moving block
-
-    gravityMovementCounter++;
-    // lateralMovementCounter++;
-    speedyGravityMovementCounter++;
+public:
+    // Versus against the given number of bots when not 0
+    TetrisApp (const GameConfig& config, const char* replayPath = nullptr, int versusBots = 0);
+    ~TetrisApp () { stop(); delete gameOverFont; delete otherFont; };
 
-    bool verticalCollision = false, horizontalCollision = false;
+    // Play online against the peer of the session instead of the local game,
+    // before start()
+    void startNetplay (std::unique_ptr<NetSession> session);
 
-    if (inputManager.isKeyPressed(SDL_SCANCODE_LEFT) || 
-        inputManager.isKeyPressed(SDL_SCANCODE_RIGHT))
-        lateralMovementCounter++;
+    // Run the simulation thread at ticksPerSecond, or as fast as possible
+    void start (bool fast);
+    // Join the simulation thread, then write the replay and end the versus
+    // match, if any. Game n > 1 of the session is saved as <replayPath>.<n>.
+    void stop ();
 
-    if (inputManager.isKeyPressed(SDL_SCANCODE_UP))
-        rotatingMovementCounter++;
+    // Main thread
+    void draw (SDL_Renderer* renderer);
+    void handleInput (const SDL_Event& event);
+    // Ticks run by the simulation, as of the last drawn frame
+    long getTicksCount () const { return shownTicks; }
 
-    if (inputManager.isKeyPressed(SDL_SCANCODE_DOWN) &&
-        speedyGravityMovementCounter >= speedyGravityDelay) {
-        gravityMovementCounter += gravitySpeed; // Increase the counter to speed up the block
-    }
+private:
+    void saveReplay ();
+};
 
-    // Check vertical movement for collision and completed row, if counter is more than treshold
-    if (gravityMovementCounter >= gravitySpeed) {
-       verticalCollision = solveVerticalCollision(); // Check collision with bottom wall and other blocks
+TetrisApp::TetrisApp (const GameConfig& config, const char* replayPath, int versusBots)
+    : stopping(false), unthrottled(false), ticksCount(0), game(config), recordPath(replayPath), recordedGames(0),
+      opponents(versusBots, game), shownGame(game), shownOpponents(opponents), overText(nullptr), waiting(false),
+      shownTicks(0)
+{
+#ifdef TETRIS_PROFILE
+    showProfile = false;
+#endif /* TETRIS_PROFILE */
 
-        checkCompletedRows();
-        // Reset the counter and then wait for the next cycle to move the block again
-        gravityMovementCounter = 0;
-    }
+    gameOverFont = nullptr;
+    otherFont = new FontManager(fontData, fontDataSize, otherFontSize);
 
-    // Check horizontal movement for collision, otherwhise move in decided direction
-    if (lateralMovementCounter >= lateralSpeed) {
-        solveHorizontalCollision();
-        lateralMovementCounter = 0;
-    }
+    if (recordPath != nullptr)
+        recorder.reset(new ReplayRecorder(ReplayHeader::fromGame(game)));
+    if (!opponents.empty())
+        startMatch(game.getSeed());
+}
 
-    // Check block rotation and rotate otherwise
-    if (rotatingMovementCounter >= rotatingSpeed) {
-        solveRotationCollision();
-        rotatingMovementCounter = 0;
-    }
+void
+TetrisApp::startNetplay (std::unique_ptr<NetSession> session)
+{
+    net = std::move(session);
+    opponents.assign(1, game);
+    shownOpponents.assign(1, game);
+}
 
-    clearGrid();
-    addCurrentBlockToGrid(verticalCollision);
+void
+TetrisApp::start (bool fast)
+{
+    unthrottled = fast;
+    publish(); // Something to draw before the first tick
+    simulation = std::thread(&TetrisApp::simulate, this);
+}
 
-    if (verticalCollision)
-        movingBlock = nullptr; // Reset moving block to start with a new one
+void
+TetrisApp::stop ()
+{
+    stopping.store(true, std::memory_order_release);
+    if (simulation.joinable())
+        simulation.join();
 
-    checkGameOver();
+    saveReplay();
+    match = nullptr;
 }
 
+//
+// The simulation advances in fixed steps of 1 / ticksPerSecond, measured with
+// the performance counter, whatever the frame rate is. Every step runs the
+// ticks due since the previous one, publishes the games once and sleeps until
+// the next tick is due.
+//
 void
-Tetris::draw (SDL_Renderer* renderer)
+TetrisApp::simulate ()
 {
-    // Clear screen
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    SDL_RenderClear(renderer);
-
-    if (gameOver) {
-        gameOverFont->drawText(renderer, (char*) "Press [enter] to play again", 100, 100);
-        std::string scoreText = "SCORE: " + std::to_string(score);
-        otherFont->drawText(renderer, (char*) scoreText.c_str(), 250, 150);
-    }
-    else {
-        // Draw blocks
-        for (int i = 0; i < grid.size(); i++) {
-            for (int j = 0; j < grid[0].size(); j++) {
-
-                SDL_Rect square = {
-                    gridPosX + (squareSize * j),
-                    gridPosY + (squareSize * i),
-                    squareSize,
-                    squareSize
-                };
-
-                if (grid[i][j] == EMPTY) {
-                    SDL_SetRenderDrawColor(renderer, 245, 245, 245, 255);
-                    // Draw a block border only
-                    SDL_RenderDrawRect(renderer, &square);
-                }
-                else {
-                    if (grid[i][j] == WALL)
-                        SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255);
-                    else if (grid[i][j] == FADING)
-                        SDL_SetRenderDrawColor(renderer, 0, 150, 0, 255);
-                    else
-                        SDL_SetRenderDrawColor(renderer, 150, 150, 150, 255);
-                    // Draw a colored block
-                    SDL_RenderFillRect(renderer, &square);
-                }
+    const Uint64 frequency = SDL_GetPerformanceFrequency();
+    const Uint64 tickDuration = frequency / ticksPerSecond;
+    Uint64 previousTime = SDL_GetPerformanceCounter();
+    Uint64 accumulator = 0;
+
+    while (!stopping.load(std::memory_order_acquire)) {
+        SDL_Event event;
+        while (events.pop(event))
+            inputManager.handlerInput(event);
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        Uint32 nowTicks = SDL_GetTicks();
+
+        if (unthrottled)
+            update(nowTicks);
+        else {
+            accumulator += now - previousTime;
+            if (accumulator > maxTicksPerStep * tickDuration)
+                accumulator = maxTicksPerStep * tickDuration;
+
+            while (accumulator >= tickDuration) {
+                accumulator -= tickDuration;
+                // Every tick sees the input up to its own time, catching up ticks are in the past
+                update(nowTicks - static_cast<Uint32>(accumulator * 1000 / frequency));
             }
         }
+        previousTime = now;
 
-        int gridWidth = squareSize * (colsN + 2);
-        // Draw next block preview
-        for (int i = 0; i < 4; i++) {
-            for (int j = 0; j < 4; j++) {
-
-                SDL_Rect square = {
-                    gridPosX + nextBlockPreviewDistance + gridWidth + (squareSize * j),
-                    gridPosY + 30 + (squareSize * i),
-                    squareSize,
-                    squareSize
-                };
-
-                if (nextBlock->shape[i][j] == EMPTY) {
-                    SDL_SetRenderDrawColor(renderer, 245, 245, 245, 255);
-                    SDL_RenderDrawRect(renderer, &square);
-                }
-                else {
-                    SDL_SetRenderDrawColor(renderer, 150, 150, 150, 255);
-                    SDL_RenderFillRect(renderer, &square);
-                }
-            }
-        }
-        otherFont->drawText(
-            renderer, 
-            (char*) "NEXT BLOCK",
-            gridPosX + nextBlockPreviewDistance + gridWidth, 
-            gridPosY
-        );
+        publish();
 
-        int blockPreviewHeight = squareSize * 4;
-        std::string scoreText = "SCORE: " + std::to_string(score);
-        otherFont->drawText(
-            renderer, 
-            (char*) scoreText.c_str(),
-            gridPosX + nextBlockPreviewDistance + gridWidth, 
-            gridPosY + 30 + blockPreviewHeight + 30
-        );
+        if (!unthrottled) {
+            Uint64 elapsed = SDL_GetPerformanceCounter() - now;
+            Uint64 untilNextTick = tickDuration - accumulator;
+            if (untilNextTick > elapsed)
+                std::this_thread::sleep_for(std::chrono::nanoseconds((untilNextTick - elapsed) * 1000000000 / frequency));
+        }
     }
-
-    SDL_RenderPresent(renderer);
 }
 
 void
-Tetris::initialize ()
+TetrisApp::publish ()
 {
-    // + 1 since we include the bottom wall, + 2 for the lateral walls
-    grid.resize(rowsN + 1, std::vector<int>(colsN + 2, EMPTY));
-    rowsToDelete.clear();
-
-    clearGrid(true);
-    setNewBlocks();
-
-    score = 0;
-    gameOver = false;
-    gravityMovementCounter = 0;
-    lateralMovementCounter = 0;
-    rotatingMovementCounter = 0;
-    rowsFadingCounter = 0;
-    speedyGravityMovementCounter = 0;
+    FrameSnapshot& frame = frames.writeBuffer();
+    frame.config = game.getConfig();
+    frame.game = game.snapshot();
+    frame.opponentsCount = static_cast<int>(opponents.size());
+    for (size_t k = 0; k < opponents.size(); k++)
+        frame.opponents[k] = opponents[k].snapshot();
+    frame.overText = getOverText();
+    frame.waiting = net != nullptr && !net->isConnected();
+    frame.ticks = ticksCount;
+    frames.publish();
 }
 
-void
-Tetris::checkCompletedRows ()
+bool
+TetrisApp::isOver () const
 {
-    int squareCounter;
-    for (int i = 0; i < rowsN; i++) {
-        squareCounter = 0;
-
-        for (int j = 0; j < colsN; j++) {
-            if (grid[i][j + 1] == BLOCK)
-                squareCounter++;
-        }
-
-        if (squareCounter == colsN) {
-            // Add rows to array for score, then set the row to FADING
-            rowsToDelete.push_back(i);
+    if (net != nullptr)
+        return net->isConnected() && (net->getSession().isOver() || net->isConnectionLost());
+    if (match != nullptr)
+        return match->isOver() || game.isGameOver();
+    return game.isGameOver();
+}
 
-            for (int j = 0; j < colsN; j++)
-                grid[i][j + 1] = FADING;
-        }
+const char*
+TetrisApp::getOverText () const
+{
+    if (!isOver())
+        return nullptr;
+
+    if (match != nullptr)
+        return game.isGameOver() ? "You lose, [enter] to play again" : "You win, [enter] to play again";
+    if (net != nullptr && net->isConnectionLost())
+        return "Connection lost";
+    if (net != nullptr) {
+        const RollbackSession& session = net->getSession();
+        return session.getWinner() == session.getLocalPlayer() ? "You win" :
+               session.getWinner() < 0 ? "Draw" : "You lose";
     }
+    return "Press [enter] to play again";
+}
 
-    if (!rowsToDelete.empty()) {
-        switch(rowsToDelete.size()) {
-            case 1: score += 40;   break;
-            case 2: score += 100;  break;
-            case 3: score += 300;  break;
-            case 4: score += 1200; break;
-        }
-    }
+void
+TetrisApp::startMatch (uint32_t seed)
+{
+    VersusOptions options;
+    options.players = 1 + static_cast<int>(opponents.size());
+    options.seed = seed;
+    options.maxTicks = std::numeric_limits<long>::max();
+    options.realTime = true;
+    options.config = game.getConfig();
+
+    // Stop the previous match before its threads are replaced
+    match = nullptr;
+    match.reset(new VersusMatch(options, [] (int player, uint32_t) {
+        return player == 0 ? nullptr : std::unique_ptr<Agent>(new PacedAgent());
+    }));
+    match->start();
 }
 
 void
-Tetris::removeCompletedRows ()
+TetrisApp::saveReplay ()
 {
-    for (const auto &rowIndex : rowsToDelete) {
-        for (int j = rowIndex; j > 0; j--)
-            grid[j] = grid[j - 1];
+    if (recorder == nullptr)
+        return;
+
+    std::string path = recordPath;
+    if (++recordedGames > 1)
+        path += "." + std::to_string(recordedGames);
 
-        grid[0] = std::vector<int>(colsN + 2, 0); // Add firt row of 0
-        grid[0][0] = grid[0][colsN + 1] = WALL;   // Set lateral walls
+    try {
+        recorder->save(path.c_str());
+        std::cout << "Replay saved to " << path << std::endl;
     }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+    recorder = nullptr;
 }
 
 void
-Tetris::solveRotationCollision ()
+TetrisApp::handleInput (const SDL_Event& event)
 {
-    bool collision = false;
-    int blockPosX = movingBlock->posX, blockPosY = movingBlock->posY;
-    // Use a temp matrix to preview the rotation and check if it collides
-    std::vector<std::vector<int> > rotatedShape = movingBlock->rotationPreview();
-
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            int sideBlock = grid[blockPosY + i][blockPosX + j];
-
-            if (rotatedShape[i][j] == MOVING && 
-                (sideBlock == BLOCK || sideBlock == WALL)) {
-                collision = true;
-            }
-        }
+#ifdef TETRIS_PROFILE
+    if (event.type == SDL_KEYDOWN && !event.key.repeat) {
+        if (event.key.keysym.scancode == SDL_SCANCODE_F3)
+            showProfile = !showProfile;
+        else if (event.key.keysym.scancode == SDL_SCANCODE_F4)
+            saveProfile();
     }
+#endif /* TETRIS_PROFILE */
 
-    if (!collision)
-        movingBlock->rotate();
+    // Only a simulation stalled for a long time fills the queue, the event is then lost
+    events.push(event);
 }
 
+#ifdef TETRIS_PROFILE
 void
-Tetris::solveHorizontalCollision ()
+TetrisApp::drawProfile (SDL_Renderer* renderer)
 {
-    bool isLeftPressed = inputManager.isKeyPressed(SDL_SCANCODE_LEFT);
-    bool isRightPressed = inputManager.isKeyPressed(SDL_SCANCODE_RIGHT);
-    int blockPosX = movingBlock->posX, blockPosY = movingBlock->posY;
-    bool collision = false;
-        
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            int sideBlock;
-            if (isLeftPressed)
-                sideBlock = grid[blockPosY + i][blockPosX + j - 1];
-            else if (isRightPressed)
-                sideBlock = grid[blockPosY + i][blockPosX + j + 1];
-            
-            // Collision if block on left/right side is a BLOCK/WALL
-            if (movingBlock->shape[i][j] == MOVING && (sideBlock == BLOCK || sideBlock == WALL)) {
-                collision = true;
-            }
-        }
+    // One line per zone over the frames in the buffer, top left of the window.
+    // Updates are timed per tick on the simulation thread.
+    for (int z = 0; z < ZONE_COUNT; z++) {
+        ProfileZone zone = static_cast<ProfileZone>(z);
+        Profiler::Stats stats = (zone == ZONE_UPDATE ? simulationProfiler : profiler).stats(zone);
+
+        char line[64];
+        std::snprintf(line, sizeof(line), "%-6s %6.2f %6.2f %6.2f", Profiler::zoneName(zone),
+                      stats.p50, stats.p99, stats.max);
+        otherFont->drawText(renderer, line, {200, 0, 0, 255}, 4, 4 + 14 * z);
     }
+}
 
-    if (!collision) {
-        if (isLeftPressed)
-            movingBlock->moveLeft();
-        else if (isRightPressed)
-            movingBlock->moveRight();
+void
+TetrisApp::saveProfile ()
+{
+    static const char* csvPath = "tetris-profile.csv";
+    static const char* tracePath = "tetris-trace.json";
+    static const char* simulationCsvPath = "tetris-sim-profile.csv";
+    static const char* simulationTracePath = "tetris-sim-trace.json";
+
+    try {
+        profiler.writeCsv(csvPath);
+        profiler.writeChromeTrace(tracePath);
+        simulationProfiler.writeCsv(simulationCsvPath);
+        simulationProfiler.writeChromeTrace(simulationTracePath);
+        std::cout << "Profile saved to " << csvPath << ", " << tracePath << ", " << simulationCsvPath
+                  << " and " << simulationTracePath << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
     }
 }
+#endif /* TETRIS_PROFILE */
 
-bool 
-Tetris::solveVerticalCollision ()
+void
+TetrisApp::update (Uint32 time)
 {
-    int blockPosX = movingBlock->posX, blockPosY = movingBlock->posY;
-
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            // If block below a moving block is BLOCK or WALL, collision is detected
-            if (movingBlock->shape[i][j] == MOVING &&
-                (grid[blockPosY + i + 1][blockPosX + j] == BLOCK || 
-                 grid[blockPosY + i + 1][blockPosX + j] == WALL)) {
-                return true;
-            }
+#ifdef TETRIS_PROFILE
+    simulationProfiler.beginFrame();
+#endif /* TETRIS_PROFILE */
+
+    ticksCount++;
+    inputManager.advance(time);
+
+    if (isOver()) {
+        saveReplay();
+
+        if (net == nullptr && inputManager.isKeyPressed(SDL_SCANCODE_RETURN)) {
+            game.reset(std::random_device()());
+            if (recordPath != nullptr)
+                recorder.reset(new ReplayRecorder(ReplayHeader::fromGame(game)));
+            if (match != nullptr)
+                startMatch(game.getSeed());
         }
+        else if (match == nullptr && net == nullptr)
+            return;
     }
 
-    movingBlock->moveDown(); // If no collision, move the block down
-    return false;
+    unsigned actions = ACTION_NONE;
+    if (inputManager.isKeyPressed(SDL_SCANCODE_LEFT))  actions |= ACTION_LEFT;
+    if (inputManager.isKeyPressed(SDL_SCANCODE_RIGHT)) actions |= ACTION_RIGHT;
+    if (inputManager.isKeyPressed(SDL_SCANCODE_UP))    actions |= ACTION_ROTATE;
+    if (inputManager.isKeyPressed(SDL_SCANCODE_DOWN))  actions |= ACTION_SOFT_DROP;
+    if (inputManager.isKeyPressed(SDL_SCANCODE_SPACE)) actions |= ACTION_HARD_DROP;
+
+    if (recorder != nullptr)
+        recorder->record(actions);
+
+    PROFILE_SCOPE_ON(simulationProfiler, ZONE_UPDATE);
+    if (match != nullptr) {
+        // The games run on the match threads, only their latest snapshots are read here
+        match->setActions(0, actions);
+        game.restore(match->snapshot(0));
+        for (size_t k = 0; k < opponents.size(); k++)
+            opponents[k].restore(match->snapshot(static_cast<int>(k) + 1));
+    }
+    else if (net != nullptr) {
+        // Kept going after the end too, the peer may still need the last inputs
+        net->tick(actions);
+        if (net->isConnected()) {
+            const RollbackSession& session = net->getSession();
+            game = session.getGame(session.getLocalPlayer());
+            opponents[0] = session.getGame(1 - session.getLocalPlayer());
+        }
+    }
+    else
+        game.update(actions);
 }
 
-void
-Tetris::checkGameOver ()
+// Board cells of both states are drawn the same
+static bool
+sameBoard (const GameState& a, const GameState& b)
 {
-    for (int j = 0; j < 2; j++) {
-        for (int i = 0; i < colsN; i++) {
-            if (grid[j][i] == BLOCK)
-                gameOver = true;
-        }
+    if (a.fadingRows != b.fadingRows || a.grid.getRows() != b.grid.getRows())
+        return false;
+    for (int i = 0; i <= a.grid.getRows(); i++) {
+        if (a.grid.row(i) != b.grid.row(i))
+            return false;
     }
+    return true;
 }
 
 void
-Tetris::setNewBlocks ()
+TetrisApp::refresh ()
 {
-    if (nextBlock == NULL)
-        movingBlock = createRandomBlock();
-    else
-        movingBlock = std::move(nextBlock); // swap block pointers
+    if (!frames.update())
+        return;
+
+    const FrameSnapshot& frame = frames.read();
+    overText = frame.overText;
+    waiting = frame.waiting;
+    shownTicks = frame.ticks;
+
+    // Joining an online game gets the host's config
+    if (std::memcmp(&frame.config, &shownGame.getConfig(), sizeof(GameConfig))) {
+        shownGame = Tetris(frame.config);
+        shownOpponents.assign(frame.opponentsCount, shownGame);
+    }
 
-    // Block start from x: half, y: 0
-    int squaresX = std::floor(gridCols / 2) - 2;
-    movingBlock->setPosition(squaresX, 0);
+    // restore() marks the whole board dirty, the batches are only rebuilt
+    // when the board really changed since the last frame
+    bool unchanged = !shownGame.getDirtyRows() && sameBoard(shownGame.snapshot(), frame.game);
+    shownGame.restore(frame.game);
+    if (unchanged)
+        shownGame.clearDirtyRows();
 
-    nextBlock = createRandomBlock();
-    speedyGravityMovementCounter = 0; // Reset the speed counter
+    for (size_t k = 0; k < shownOpponents.size(); k++)
+        shownOpponents[k].restore(frame.opponents[k]);
 }
 
 void
-Tetris::addCurrentBlockToGrid (bool addAsBlock)
+TetrisApp::rebuildBoardBatches ()
 {
-    int blockPosX = movingBlock->posX, blockPosY = movingBlock->posY;
-
-    for (int i = 0; i < 4; i++) {
-        if ((blockPosY + i) >= grid.size()) // Prevent outiside grid indexing
-            return;
-        
-        for (int j = 0; j < 4; j++) {
-            if (addAsBlock && movingBlock->shape[i][j] == MOVING)
-                // Make moving block a fixed one
-                grid[blockPosY + i][blockPosX + j] = BLOCK;
-            else
-                // Transfer the moving block to the grid
-                grid[blockPosY + i][blockPosX + j] += movingBlock->shape[i][j]; 
+    const Tetris& game = shownGame;
+    for (auto& batch : boardBatches)
+        batch.clear();
+
+    for (int i = 0; i < game.getRows() + 1; i++) {
+        for (int j = 0; j < game.getCols() + 2; j++) {
+            BlockState cell = game.boardCellState(i, j);
+            Batch batch = cell == WALL ? BATCH_WALL :
+                          cell == FADING ? BATCH_FADING :
+                          cell == BLOCK ? BATCH_BLOCK : BATCH_EMPTY;
+
+            boardBatches[batch].push_back(cellRect(gridPosX, gridPosY, i, j));
         }
     }
 }
 
 void
-Tetris::clearGrid (bool fullClean)
+TetrisApp::drawOpponents (SDL_Renderer* renderer, int x)
 {
-    for (int i = 0; i < grid.size(); i++) {
-        for (int j = 0; j < grid[0].size(); j++) {
-            if (grid[i][j] == MOVING || fullClean)
-                grid[i][j] = EMPTY;
+    opponentsBatch.clear();
+    opponentsWallBatch.clear();
+
+    int boardWidth = opponentSquareSize * (shownGame.getCols() + 2);
+    for (size_t k = 0; k < shownOpponents.size(); k++) {
+        const Tetris& opponent = shownOpponents[k];
+        int boardX = x + static_cast<int>(k) * (boardWidth + opponentsGap);
+
+        for (int i = 0; i < opponent.getRows() + 1; i++) {
+            for (int j = 0; j < opponent.getCols() + 2; j++) {
+                BlockState cell = opponent.cellState(i, j);
+                if (cell == EMPTY)
+                    continue;
+
+                SDL_Rect rect = { boardX + opponentSquareSize * j, gridPosY + opponentSquareSize * i,
+                                  opponentSquareSize, opponentSquareSize };
+                (cell == WALL ? opponentsWallBatch : opponentsBatch).push_back(rect);
+            }
         }
-        grid[i][0] = grid[i][colsN + 1] = WALL;
-    }
 
-    for (int i = 1; i < colsN + 1; i++) {
-        grid[rowsN][i] = WALL;
+        if (opponent.isGameOver())
+            otherFont->drawText(renderer, "OUT", boardX, gridPosY + opponentSquareSize * (opponent.getRows() + 1) + 10);
     }
+
+    SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255);
+    drawRects(renderer, opponentsWallBatch, true);
+    SDL_SetRenderDrawColor(renderer, 150, 150, 150, 255);
+    drawRects(renderer, opponentsBatch, true);
 }
 
-std::unique_ptr<Block>
-Tetris::createRandomBlock ()
+void
+TetrisApp::draw (SDL_Renderer* renderer)
 {
-    int blockIdx = randomNumber(0, BLOCKTYPE_COUNT - 1);
-    BlockType type = static_cast<BlockType>(blockIdx);
-    return std::make_unique<Block>(type);
+    PROFILE_SCOPE(ZONE_DRAW);
+
+    refresh();
+    Tetris& game = shownGame;
+
+    // Clear screen
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderClear(renderer);
+
+    int colsN = game.getCols();
+    int previewCount = game.getConfig().previewCount;
+    char scoreText[32];
+    std::snprintf(scoreText, sizeof(scoreText), "SCORE: %d  LEVEL: %d", game.getScore(), game.getLevel());
+
+    int gridWidth = squareSize * (colsN + 2);
+    int previewX = gridPosX + nextBlockPreviewDistance + gridWidth;
+    int previewY = gridPosY + 30;
+
+    if (!shownOpponents.empty())
+        drawOpponents(renderer, previewX + squareSize * 4 + opponentsGap);
+    if (waiting)
+        otherFont->drawText(renderer, "WAITING FOR THE OTHER PLAYER", gridPosX, gridPosY / 3);
+
+    if (overText != nullptr) {
+        if (gameOverFont == nullptr)
+            gameOverFont = new FontManager(fontData, fontDataSize, gameOverFontSize);
+        gameOverFont->drawText(renderer, overText, 100, 100);
+        otherFont->drawText(renderer, scoreText, 250, 150);
+    }
+    else {
+        // Cells are grouped by color and drawn with one call per group. Board
+        // cells only change when blocks lock or rows are removed, so their
+        // rectangles are kept between frames. Any dirty row rebuilds them for
+        // the whole board: the snapshot restore marks every row dirty anyway.
+        if (game.getDirtyRows()) {
+            rebuildBoardBatches();
+            game.clearDirtyRows();
+        }
+
+        previewEmptyBatch.clear();
+        blocksBatch.clear();
+        ghostBatch.clear();
+
+        // The moving block and its ghost only cover empty cells of the board
+        const Block* movingBlock = game.getMovingBlock();
+        if (movingBlock != nullptr) {
+            Block ghost = game.getGhostBlock();
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    if (!movingBlock->isFilled(i, j))
+                        continue;
+                    if (movingBlock->posY + i >= 0)
+                        blocksBatch.push_back(cellRect(gridPosX, gridPosY, movingBlock->posY + i, movingBlock->posX + j));
+                    if (ghost.posY != movingBlock->posY)
+                        ghostBatch.push_back(cellRect(gridPosX, gridPosY, ghost.posY + i, ghost.posX + j));
+                }
+            }
+        }
+
+        // Next blocks preview
+        for (int k = 0; k < previewCount; k++) {
+            Block nextBlock = game.getNextBlock(k);
+            int y = previewY + k * previewStep;
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    if (nextBlock.isFilled(i, j))
+                        blocksBatch.push_back(cellRect(previewX, y, i, j));
+                    else
+                        previewEmptyBatch.push_back(cellRect(previewX, y, i, j));
+                }
+            }
+        }
+
+        // Empty cells only get a border
+        SDL_SetRenderDrawColor(renderer, 245, 245, 245, 255);
+        drawRects(renderer, boardBatches[BATCH_EMPTY], false);
+        drawRects(renderer, previewEmptyBatch, false);
+
+        SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255);
+        drawRects(renderer, boardBatches[BATCH_WALL], true);
+        SDL_SetRenderDrawColor(renderer, 0, 150, 0, 255);
+        drawRects(renderer, boardBatches[BATCH_FADING], true);
+        SDL_SetRenderDrawColor(renderer, 150, 150, 150, 255);
+        drawRects(renderer, boardBatches[BATCH_BLOCK], true);
+        drawRects(renderer, blocksBatch, true);
+        drawRects(renderer, ghostBatch, false);
+
+        if (previewCount > 0) {
+            otherFont->drawText(
+                renderer,
+                previewCount > 1 ? "NEXT BLOCKS" : "NEXT BLOCK",
+                previewX,
+                gridPosY
+            );
+        }
+
+        int blockPreviewHeight = squareSize * 4;
+        otherFont->drawText(
+            renderer, 
+            scoreText,
+            previewX, 
+            previewY + (previewCount > 0 ? (previewCount - 1) * previewStep + blockPreviewHeight : 0) + 30
+        );
+    }
+
+#ifdef TETRIS_PROFILE
+    if (showProfile)
+        drawProfile(renderer);
+#endif /* TETRIS_PROFILE */
+
+    SDL_RenderPresent(renderer);
 }
 
 //------------------------------------------------------------------------------------
 // Functions declarations
 //------------------------------------------------------------------------------------
-void initSDL();
+void initSDL(bool vsync, int width, int height);
 void quit();
 
 //------------------------------------------------------------------------------------
@@ -659,37 +884,158 @@ void quit();
 //------------------------------------------------------------------------------------
 SDL_Window*   window;
 SDL_Renderer* renderer;
-TTF_Font*     font;
 
 //------------------------------------------------------------------------------------
 // Main
 //------------------------------------------------------------------------------------
+//
+// The simulation runs on its own thread at ticksPerSecond, and the main thread
+// pumps the events and draws the latest games it published, whatever the
+// frame rate is.
+//  --vsync          present frames in sync with the display
+//  --unthrottled    ticks as fast as possible, for benchmarks
+//  --record <file>  save a replay of every game, play it with tetris-headless -p
+//  --size <c>x<r>   grid of c columns and r rows (default 10x20)
+//  --preview <n>    number of upcoming blocks shown (default 1)
+//  --bag            deal blocks from a 7-bag instead of uniformly
+//  --level <n>      start level, gravity speeds up every 10 lines (default 0)
+//  --versus <n>     play against n bots, cleared rows send garbage to them
+//  --host <port>    host a versus game over UDP, with these settings
+//  --join <h>:<p>   join a versus game hosted on host h, port p
+//
+// Built with make profile, F3 shows the p50/p99/max frame time of every zone
+// in ms and F4 writes tetris-profile.csv and a Chrome trace, tetris-trace.json,
+// along with tetris-sim-profile.csv and tetris-sim-trace.json for the ticks.
+//
 int
 main (int argc, char* argv[])
 {
+    bool vsync = false, unthrottled = false;
+    const char* replayPath = nullptr;
+    int versusBots = 0;
+    int netPort = 0;
+    std::string joinHost;
+    std::unique_ptr<NetSession> net;
+    GameConfig config;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+
+        if (!std::strcmp(argv[i], "--vsync"))
+            vsync = true;
+        else if (!std::strcmp(argv[i], "--unthrottled"))
+            unthrottled = true;
+        else if (!std::strcmp(argv[i], "--record") && hasValue)
+            replayPath = argv[++i];
+        else if (!std::strcmp(argv[i], "--size") && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &config.cols, &config.rows) != 2)
+                config.cols = 0; // Rejected below
+        }
+        else if (!std::strcmp(argv[i], "--preview") && hasValue)
+            config.previewCount = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--bag"))
+            config.randomizer = RANDOMIZER_BAG;
+        else if (!std::strcmp(argv[i], "--level") && hasValue)
+            config.startLevel = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--versus") && hasValue)
+            versusBots = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--host") && hasValue)
+            netPort = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--join") && hasValue && std::strchr(argv[i + 1], ':')) {
+            joinHost = argv[++i];
+            netPort = std::atoi(joinHost.c_str() + joinHost.rfind(':') + 1);
+            joinHost.resize(joinHost.rfind(':'));
+        }
+        else {
+            std::cout << "Usage: " << argv[0] << " [--vsync] [--unthrottled] [--record <file>]"
+                      << " [--size <cols>x<rows>] [--preview <n>] [--bag] [--level <n>] [--versus <n>]"
+                      << " [--host <port>] [--join <host>:<port>]" << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        config.validate();
+        if (versusBots < 0 || versusBots >= VersusMatch::maxPlayers)
+            throw std::runtime_error("Unsupported number of versus bots");
+        if ((versusBots > 0 || netPort != 0) && replayPath != nullptr)
+            throw std::runtime_error("Versus games cannot be recorded");
+        if (versusBots > 0 && netPort != 0)
+            throw std::runtime_error("Online games have no bots");
+
+        if (!joinHost.empty())
+            net.reset(new NetSession(joinHost.c_str(), static_cast<uint16_t>(netPort)));
+        else if (netPort != 0) {
+            RollbackOptions options;
+            options.seed = std::random_device()();
+            options.config = config;
+            net.reset(new NetSession(static_cast<uint16_t>(netPort), options));
+        }
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
     // Clear SDL2 stuff before termination
     std::atexit(quit);
-    std::srand((unsigned) std::time(0));
 
-    initSDL();
+    // Room for the grid and the preview column, walls included
+    int previewRows = config.previewCount > 0 ? (config.previewCount - 1) * previewStep + squareSize * 4 : 0;
+    int width = std::max(screenWidth, gridPosX * 2 + squareSize * (config.cols + 2 + 4) + nextBlockPreviewDistance);
+    int opponentsCount = net != nullptr ? 1 : versusBots;
+    width += opponentsCount * (opponentSquareSize * (config.cols + 2) + opponentsGap);
+    int height = std::max(screenHeight, gridPosY * 2 + std::max(squareSize * (config.rows + 1), previewRows + 80));
+    initSDL(vsync && !unthrottled, width, height);
+
+    TetrisApp game(config, replayPath, versusBots);
+    if (net != nullptr)
+        game.startNetplay(std::move(net));
+
+    game.start(unthrottled);
 
-    Tetris game(gridCols, gridRows, defaultFontPath.c_str());
+    const Uint64 frequency = SDL_GetPerformanceFrequency();
+    // Ticks counted to show the simulation speed of the unthrottled mode
+    Uint64 statsTime = SDL_GetPerformanceCounter();
+    long statsTicks = 0;
 
     while (1) {
-        SDL_Event evt;
-
-        while (SDL_PollEvent(&evt)) {
-            // Exit or let the game object handle keyboard input
-            if (evt.type == SDL_QUIT)
-                exit(0);
-            else 
-                game.handleInput(evt);
+#ifdef TETRIS_PROFILE
+        profiler.beginFrame();
+#endif /* TETRIS_PROFILE */
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        {
+            PROFILE_SCOPE(ZONE_EVENTS);
+            SDL_Event evt;
+
+            while (SDL_PollEvent(&evt)) {
+                // Exit or let the game object handle keyboard input
+                if (evt.type == SDL_QUIT) {
+                    game.stop();
+                    exit(0);
+                }
+                else 
+                    game.handleInput(evt);
+            }
         }
 
-        game.update();
         game.draw(renderer);
 
-        SDL_Delay(10);
+        if (unthrottled && now - statsTime >= frequency) {
+            char title[64];
+            std::snprintf(title, sizeof(title), "Tetris - %ld ticks/s", game.getTicksCount() - statsTicks);
+            SDL_SetWindowTitle(window, title);
+            statsTime = now;
+            statsTicks = game.getTicksCount();
+        }
+
+        // Without vsync, draw about once per tick rather than the same state over and over
+        if (!vsync || unthrottled) {
+            Uint64 elapsed = SDL_GetPerformanceCounter() - now;
+            Uint64 frameDuration = frequency / ticksPerSecond;
+            if (frameDuration > elapsed)
+                SDL_Delay(static_cast<Uint32>((frameDuration - elapsed) * 1000 / frequency));
+        }
     }
 
     return 0;
@@ -697,26 +1043,21 @@ main (int argc, char* argv[])
 
 
 void
-initSDL ()
+initSDL (bool vsync, int width, int height)
 {
-    if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
+    // Only what the game uses, audio and game controllers are slow to start
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0) {
         std::cout << "Error initializing SDL: " << SDL_GetError() << std::endl;
         system("pause");
         exit(-1);
     }
 
-    if (TTF_Init() < 0) {
-        std::cout << "Error initializing SDL_ttf: " << SDL_GetError() << std::endl;
-        system("pause");
-        exit(-1);
-    }
-
     window = SDL_CreateWindow(
         "Tetris",                           // window title
         SDL_WINDOWPOS_UNDEFINED,           // initial x position
         SDL_WINDOWPOS_UNDEFINED,           // initial y position
-        screenWidth,                      // width, in pixels
-        screenHeight,                     // height, in pixels
+        width,                            // width, in pixels
+        height,                           // height, in pixels
         SDL_WINDOW_SHOWN                  // flags - see below
     );
     if (!window) {
@@ -725,7 +1066,11 @@ initSDL ()
         exit(-1);
     }
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    Uint32 rendererFlags = SDL_RENDERER_ACCELERATED;
+    if (vsync)
+        rendererFlags |= SDL_RENDERER_PRESENTVSYNC;
+
+    renderer = SDL_CreateRenderer(window, -1, rendererFlags);
     if (!renderer) {
         std::cout << "Error creating renderer: " << SDL_GetError() << std::endl;
         exit(-1);
@@ -740,6 +1085,7 @@ quit ()
 {
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
-    TTF_Quit();
+    if (TTF_WasInit())
+        TTF_Quit();
     SDL_Quit();
 }
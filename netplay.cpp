@@ -0,0 +1,292 @@
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "netplay.h"
+#include "replay.h"
+
+//------------------------------------------------------------------------------------
+// Constants Definition
+//------------------------------------------------------------------------------------
+static const uint8_t packetMagic[2] = { 'T', 'N' };
+static const unsigned netplayVersion = 2;
+
+enum PacketType {
+    PACKET_HELLO   = 1,
+    PACKET_WELCOME = 2,
+    PACKET_INPUTS  = 3,
+};
+
+// Larger than any packet, inputs are bounded by the rollback history
+static const int maxPacketSize = 1024;
+
+// Bound to references by std::chrono, so they need a definition
+const int NetSession::helloIntervalMs;
+const int NetSession::timeoutMs;
+
+//------------------------------------------------------------------------------------
+// UDP socket
+//------------------------------------------------------------------------------------
+UdpSocket::UdpSocket (uint16_t port) : peerAddress(), peerLength(0)
+{
+    // Dual stack when there is IPv6, IPv4 peers then show up as mapped addresses
+    family = AF_INET6;
+    fd = ::socket(family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        family = AF_INET;
+        fd = ::socket(family, SOCK_DGRAM, 0);
+    }
+    if (fd < 0)
+        throw std::runtime_error("Failed to create the UDP socket");
+
+    sockaddr_storage address = {};
+    socklen_t length;
+    if (family == AF_INET6) {
+        int off = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+        sockaddr_in6& any = reinterpret_cast<sockaddr_in6&>(address);
+        any.sin6_family = AF_INET6;
+        any.sin6_addr = in6addr_any;
+        any.sin6_port = htons(port);
+        length = sizeof(sockaddr_in6);
+    }
+    else {
+        sockaddr_in& any = reinterpret_cast<sockaddr_in&>(address);
+        any.sin_family = AF_INET;
+        any.sin_addr.s_addr = htonl(INADDR_ANY);
+        any.sin_port = htons(port);
+        length = sizeof(sockaddr_in);
+    }
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), length) < 0 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        close(fd);
+        throw std::runtime_error("Failed to bind UDP port " + std::to_string(port));
+    }
+}
+
+UdpSocket::~UdpSocket ()
+{
+    close(fd);
+}
+
+void
+UdpSocket::setPeer (const char* host, uint16_t port)
+{
+    addrinfo hints = {};
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (family == AF_INET6)
+        hints.ai_flags = AI_V4MAPPED | AI_ALL;
+
+    addrinfo* result = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host, service.c_str(), &hints, &result) != 0 || result == nullptr)
+        throw std::runtime_error(std::string("Failed to resolve ") + host);
+
+    std::memcpy(&peerAddress, result->ai_addr, result->ai_addrlen);
+    peerLength = static_cast<socklen_t>(result->ai_addrlen);
+    freeaddrinfo(result);
+}
+
+void
+UdpSocket::send (const std::vector<uint8_t>& data)
+{
+    if (hasPeer())
+        sendto(fd, data.data(), data.size(), 0, reinterpret_cast<const sockaddr*>(&peerAddress), peerLength);
+}
+
+bool
+UdpSocket::receive (std::vector<uint8_t>& data)
+{
+    data.resize(maxPacketSize);
+
+    for (;;) {
+        sockaddr_storage from;
+        socklen_t fromLength = sizeof(from);
+        ssize_t size = recvfrom(fd, data.data(), data.size(), 0, reinterpret_cast<sockaddr*>(&from), &fromLength);
+        if (size < 0)
+            return false;
+
+        if (!hasPeer()) {
+            peerAddress = from;
+            peerLength = fromLength;
+        }
+        else if (fromLength != peerLength || std::memcmp(&from, &peerAddress, fromLength))
+            continue; // Someone else
+
+        data.resize(static_cast<size_t>(size));
+        return true;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// Netplay
+//------------------------------------------------------------------------------------
+NetSession::NetSession (uint16_t port, const RollbackOptions& opts)
+    : socket(port), hosting(true), options(opts), remoteAck(0), ticksSinceSend(0),
+      lastSentActions(ACTION_NONE), lastReceive(Clock::now()), lastHello(), bytesSent(0), bytesReceived(0)
+{
+    // Fail here rather than when the peer joins
+    options.config.validate();
+}
+
+NetSession::NetSession (const char* host, uint16_t port)
+    : socket(0), hosting(false), remoteAck(0), ticksSinceSend(0),
+      lastSentActions(ACTION_NONE), lastReceive(Clock::now()), lastHello(), bytesSent(0), bytesReceived(0)
+{
+    socket.setPeer(host, port);
+    sendHello();
+}
+
+bool
+NetSession::isConnectionLost () const
+{
+    return session != nullptr && Clock::now() - lastReceive > std::chrono::milliseconds(timeoutMs);
+}
+
+void
+NetSession::sendHello ()
+{
+    packet.assign(packetMagic, packetMagic + sizeof(packetMagic));
+    packet.push_back(PACKET_HELLO);
+    writeVarint(packet, netplayVersion);
+
+    socket.send(packet);
+    bytesSent += packet.size();
+    lastHello = Clock::now();
+}
+
+void
+NetSession::sendWelcome ()
+{
+    packet.assign(packetMagic, packetMagic + sizeof(packetMagic));
+    packet.push_back(PACKET_WELCOME);
+    writeVarint(packet, netplayVersion);
+    writeVarint(packet, options.inputDelay);
+    ReplayHeader{ options.seed, options.config }.encode(packet);
+
+    socket.send(packet);
+    bytesSent += packet.size();
+}
+
+void
+NetSession::sendInputs ()
+{
+    packet.assign(packetMagic, packetMagic + sizeof(packetMagic));
+    packet.push_back(PACKET_INPUTS);
+    writeVarint(packet, session->getRemoteTicks());
+
+    // Every input the peer may still miss, the older ones left the history
+    long end = session->getLocalTicks();
+    long first = std::max(remoteAck, end - RollbackSession::historySize);
+    writeVarint(packet, first);
+
+    for (long tick = first; tick < end; ) {
+        unsigned actions = session->localActionsAt(tick);
+        long run = 1;
+        while (tick + run < end && session->localActionsAt(tick + run) == actions)
+            run++;
+
+        writeVarint(packet, (static_cast<uint64_t>(run) << replayActionBits) | actions);
+        tick += run;
+    }
+
+    socket.send(packet);
+    bytesSent += packet.size();
+    ticksSinceSend = 0;
+    lastSentActions = end > 0 ? session->localActionsAt(end - 1) : static_cast<unsigned>(ACTION_NONE);
+}
+
+void
+NetSession::handle (const std::vector<uint8_t>& data)
+{
+    if (data.size() < 3 || std::memcmp(data.data(), packetMagic, sizeof(packetMagic)))
+        return;
+
+    size_t pos = 3;
+    switch (data[2]) {
+    case PACKET_HELLO:
+        // Answered every time, the first WELCOME may be lost
+        if (!hosting || readVarint(data, pos) != netplayVersion)
+            return;
+        if (session == nullptr)
+            session.reset(new RollbackSession(options, 0));
+        sendWelcome();
+        break;
+
+    case PACKET_WELCOME:
+        if (hosting || session != nullptr || readVarint(data, pos) != netplayVersion)
+            return;
+        options.inputDelay = static_cast<int>(readVarint(data, pos));
+        {
+            ReplayHeader header = ReplayHeader::decode(data, pos);
+            options.seed = header.seed;
+            options.config = header.config;
+        }
+        session.reset(new RollbackSession(options, 1));
+        break;
+
+    case PACKET_INPUTS: {
+        if (session == nullptr)
+            return;
+        remoteAck = std::max(remoteAck, static_cast<long>(readVarint(data, pos)));
+
+        long tick = static_cast<long>(readVarint(data, pos));
+        while (pos < data.size()) {
+            uint64_t run = readVarint(data, pos);
+            unsigned actions = static_cast<unsigned>(run & ((1u << replayActionBits) - 1));
+            // No packet holds more than the history, whatever a garbled one says
+            long length = static_cast<long>(std::min<uint64_t>(run >> replayActionBits, RollbackSession::historySize));
+            for (long end = tick + length; tick < end; tick++)
+                session->addRemoteActions(tick, actions);
+        }
+        break;
+    }
+
+    default:
+        return;
+    }
+
+    lastReceive = Clock::now();
+}
+
+void
+NetSession::poll ()
+{
+    while (socket.receive(received)) {
+        bytesReceived += received.size();
+        try {
+            handle(received);
+        }
+        catch (const std::exception&) {
+            // Garbled packet or config, dropped like a lost one
+        }
+    }
+
+    if (!hosting && session == nullptr && Clock::now() - lastHello > std::chrono::milliseconds(helloIntervalMs))
+        sendHello();
+}
+
+bool
+NetSession::tick (unsigned actions)
+{
+    poll();
+    if (session == nullptr)
+        return false;
+
+    long ticks = session->getTicks();
+    session->advance(actions);
+    bool played = session->getTicks() > ticks;
+
+    if (++ticksSinceSend >= sendInterval || (played && actions != lastSentActions))
+        sendInputs();
+    return played;
+}
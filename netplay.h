@@ -0,0 +1,109 @@
+#ifndef TETRIS_NETPLAY_H
+#define TETRIS_NETPLAY_H
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "rollback.h"
+
+//------------------------------------------------------------------------------------
+// UDP socket
+//------------------------------------------------------------------------------------
+// Non-blocking UDP socket talking with a single peer (POSIX sockets)
+class UdpSocket {
+private:
+    int fd;
+    int family;
+    sockaddr_storage peerAddress;
+    socklen_t peerLength; // 0 until the peer is known
+
+public:
+    // Bound to the port on every interface, 0 picks any free port. Throws
+    // std::runtime_error when the socket cannot be created or bound.
+    explicit UdpSocket (uint16_t port = 0);
+    ~UdpSocket ();
+
+    UdpSocket (const UdpSocket&) = delete;
+    UdpSocket& operator= (const UdpSocket&) = delete;
+
+    // Throws std::runtime_error when the host cannot be resolved
+    void setPeer (const char* host, uint16_t port);
+    bool hasPeer () const { return peerLength != 0; }
+
+    // Datagrams are dropped on any error, like the network would
+    void send (const std::vector<uint8_t>& data);
+    // Next datagram from the peer, false when there is none. Without a peer,
+    // the first sender becomes the peer.
+    bool receive (std::vector<uint8_t>& data);
+};
+
+//------------------------------------------------------------------------------------
+// Netplay
+//------------------------------------------------------------------------------------
+//
+// Online versus of two peers over UDP, exchanging only inputs. The host waits
+// for a HELLO and answers with a WELCOME holding the seed and config, encoded
+// like a replay header, and both sides then run a RollbackSession.
+// Packets carry every local input the peer has not acknowledged yet, as runs
+// of the same actions, so a lost packet is covered by the next one. A packet
+// is sent when the actions change and every sendInterval ticks otherwise:
+//   "TN" type ...                       all numbers are LEB128 varints
+//   HELLO    version
+//   WELCOME  version inputDelay seed config
+//   INPUTS   ack firstTick (runLength << replayActionBits | actions)...
+// where ack is the number of inputs received from the peer. Holding keys
+// costs a few bytes 20 times per second, a few hundred bytes per second.
+//
+class NetSession {
+public:
+    static const int sendInterval = 5;        // Ticks
+    static const int helloIntervalMs = 200;
+    static const int timeoutMs = 5000;        // Silence before the connection is lost
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    UdpSocket socket;
+    bool hosting;
+    RollbackOptions options; // The host's
+    std::unique_ptr<RollbackSession> session;
+
+    long remoteAck;          // Local inputs the peer received
+    long ticksSinceSend;
+    unsigned lastSentActions;
+    Clock::time_point lastReceive, lastHello;
+
+    std::vector<uint8_t> packet, received;
+    long bytesSent, bytesReceived;
+
+    void sendHello ();
+    void sendWelcome ();
+    void sendInputs ();
+    void handle (const std::vector<uint8_t>& data);
+
+public:
+    // Host a game on the port, the options are sent to the peer joining it
+    NetSession (uint16_t port, const RollbackOptions& opts);
+    // Join the game hosted on host:port, as player 1
+    NetSession (const char* host, uint16_t port);
+
+    bool isConnected () const { return session != nullptr; }
+    bool isConnectionLost () const;
+    // Only valid once connected
+    const RollbackSession& getSession () const { return *session; }
+
+    // Handle the packets received, call at least once per tick
+    void poll ();
+    // Play a tick with the local actions and send them. False while not
+    // connected or stalled, waiting for the peer inputs.
+    bool tick (unsigned actions);
+
+    long getBytesSent () const { return bytesSent; }
+    long getBytesReceived () const { return bytesReceived; }
+};
+
+#endif /* TETRIS_NETPLAY_H */
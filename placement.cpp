@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cstring>
+
+#include "placement.h"
+
+PlacementFinder::PlacementFinder ()
+{
+    // A 10x20 grid has a few hundred reachable positions at most
+    nodes.reserve(1024);
+    placements.reserve(256);
+}
+
+void
+PlacementFinder::visit (const Board& grid, BlockType type, int x, int y, int rotation,
+                        unsigned action, int parent)
+{
+    int slot = x + xOffset, bit = y + yOffset;
+    if (slot < 0 || slot >= xSlots || bit < 0 || bit >= 64)
+        return;
+
+    uint64_t& column = visited[rotation][slot];
+    if ((column >> bit) & 1)
+        return;
+    column |= 1ull << bit;
+
+    if (grid.collides(blockRotations.shapes[type][rotation], x, y))
+        return;
+
+    nodes.push_back({ static_cast<int8_t>(x), static_cast<int8_t>(y), static_cast<int8_t>(rotation),
+                      static_cast<uint8_t>(action), parent });
+}
+
+const std::vector<Placement>&
+PlacementFinder::find (const Board& grid, const Block& block)
+{
+    nodes.clear();
+    placements.clear();
+    std::memset(visited, 0, sizeof(visited));
+    std::memset(landed, 0, sizeof(landed));
+
+    BlockType type = block.type;
+    visit(grid, type, block.posX, block.posY, block.rotation, ACTION_NONE, -1);
+
+    // The queue grows while it is walked, nodes are only read by index
+    for (int n = 0; n < static_cast<int>(nodes.size()); n++) {
+        Node node = nodes[n];
+        int x = node.x, y = node.y, r = node.rotation;
+
+        if (grid.collides(blockRotations.shapes[type][r], x, y + 1)) {
+            // Resting on something: a placement, unless the same cells were already found
+            int c = blockRotations.canonical[type][r];
+            int slot = x + blockRotations.offsetX[type][r] + xOffset;
+            int bit = y + blockRotations.offsetY[type][r] + yOffset;
+            uint64_t& column = landed[c][slot];
+
+            if (!((column >> bit) & 1)) {
+                column |= 1ull << bit;
+
+                Block placed(type);
+                placed.rotation = r;
+                placed.setPosition(x, y);
+                placements.push_back({ placed, n });
+            }
+        }
+        else
+            visit(grid, type, x, y + 1, r, ACTION_SOFT_DROP, n);
+
+        visit(grid, type, x - 1, y, r, ACTION_LEFT, n);
+        visit(grid, type, x + 1, y, r, ACTION_RIGHT, n);
+        if (type != O) {
+            // Kicked like the game would, so paths replay as planned
+            Block rotated(type);
+            rotated.rotation = r;
+            rotated.setPosition(x, y);
+            if (rotateBlock(grid, rotated))
+                visit(grid, type, rotated.posX, rotated.posY, rotated.rotation, ACTION_ROTATE, n);
+        }
+    }
+
+    return placements;
+}
+
+void
+PlacementFinder::path (const Placement& p, std::vector<Action>& steps) const
+{
+    steps.clear();
+    for (int n = p.node; n > 0; n = nodes[n].parent)
+        steps.push_back(static_cast<Action>(nodes[n].action));
+    std::reverse(steps.begin(), steps.end());
+}
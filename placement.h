@@ -0,0 +1,62 @@
+#ifndef TETRIS_PLACEMENT_H
+#define TETRIS_PLACEMENT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "tetris.h"
+
+// A position where a block locks: the block resting on the stack or floor
+struct Placement {
+    Block block;
+    int   node; // Last step of the path leading here, see PlacementFinder::path()
+};
+
+//
+// Enumerates every position the moving block can lock at, by a breadth-first
+// search over (x, y, rotation) from its current position. Every step is one
+// press of left, right or rotate, with its wall kicks, or one row down
+// (ACTION_SOFT_DROP), tested with the board bitboard and the precomputed
+// rotations. Placements covering the same cells are only returned once, so
+// the O block gives one placement per column and I, S and Z two orientations
+// instead of four.
+//
+// The finder keeps its buffers between calls, reuse one per thread: a search
+// then allocates nothing.
+//
+class PlacementFinder {
+private:
+    // Positions are stored with x + xOffset and y + yOffset, so blocks partly
+    // out of the grid on the left or top still get a slot
+    static const int xOffset = 3;
+    static const int yOffset = 4;
+    static const int xSlots = Board::maxCols + 2 + xOffset;
+
+    struct Node {
+        int8_t  x, y, rotation;
+        uint8_t action; // Step from the parent node
+        int     parent;
+    };
+
+    std::vector<Node> nodes; // BFS queue, every visited position in order
+    std::vector<Placement> placements;
+    // Bit y + yOffset of visited[r][x + xOffset] set once position x, y, r is
+    // queued, landed[] is the same for the canonical orientations of placements
+    uint64_t visited[4][xSlots];
+    uint64_t landed[4][xSlots];
+
+    void visit (const Board& grid, BlockType type, int x, int y, int rotation, unsigned action, int parent);
+
+public:
+    PlacementFinder ();
+
+    // Every distinct placement reachable by block, empty if it already collides.
+    // The result stays valid until the next call.
+    const std::vector<Placement>& find (const Board& grid, const Block& block);
+
+    // Steps from the searched block to placement p, in order, shortest first.
+    // Only valid for placements of the last find().
+    void path (const Placement& p, std::vector<Action>& steps) const;
+};
+
+#endif /* TETRIS_PLACEMENT_H */
@@ -0,0 +1,176 @@
+#include "profiler.h"
+
+// Nothing to build without profiling, the header leaves only empty macros
+#ifdef TETRIS_PROFILE
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+static_assert(sizeof(Profiler::Frame) % sizeof(uint64_t) == 0, "Frames are copied as 64-bit words");
+
+Profiler profiler;
+Profiler simulationProfiler;
+
+Profiler::Profiler () : epoch(Clock::now()), current(), inFrame(false), head(0)
+{
+    for (Slot& slot : slots)
+        slot.sequence.store(0, std::memory_order_relaxed);
+}
+
+void
+Profiler::store (const Frame& frame)
+{
+    Slot& slot = slots[frame.number & (maxFrames - 1)];
+    uint64_t words[frameWords];
+    std::memcpy(words, &frame, sizeof(Frame));
+
+    slot.sequence.store(2 * frame.number + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int w = 0; w < frameWords; w++)
+        slot.words[w].store(words[w], std::memory_order_relaxed);
+    slot.sequence.store(2 * frame.number + 2, std::memory_order_release);
+}
+
+bool
+Profiler::load (uint64_t number, Frame& frame) const
+{
+    const Slot& slot = slots[number & (maxFrames - 1)];
+    uint64_t stored = 2 * number + 2;
+    if (slot.sequence.load(std::memory_order_acquire) != stored)
+        return false;
+
+    uint64_t words[frameWords];
+    for (int w = 0; w < frameWords; w++)
+        words[w] = slot.words[w].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != stored)
+        return false;
+
+    std::memcpy(&frame, words, sizeof(Frame));
+    return true;
+}
+
+std::vector<Profiler::Frame>
+Profiler::recentFrames () const
+{
+    uint64_t h = head.load(std::memory_order_acquire);
+    std::vector<Frame> recent;
+    recent.reserve(static_cast<size_t>(std::min<uint64_t>(h, maxFrames)));
+
+    Frame frame;
+    for (uint64_t f = h > maxFrames ? h - maxFrames : 0; f < h; f++) {
+        if (load(f, frame))
+            recent.push_back(frame);
+    }
+    return recent;
+}
+
+void
+Profiler::beginFrame ()
+{
+    int64_t t = now();
+
+    if (inFrame) {
+        current.offset[ZONE_FRAME] = 0;
+        current.duration[ZONE_FRAME] = static_cast<uint32_t>(t - current.start);
+
+        current.number = head.load(std::memory_order_relaxed);
+        store(current);
+        head.store(current.number + 1, std::memory_order_release);
+    }
+
+    current = Frame();
+    current.start = t;
+    inFrame = true;
+}
+
+void
+Profiler::add (ProfileZone zone, int64_t start, int64_t end)
+{
+    if (!inFrame)
+        return;
+
+    if (current.duration[zone] == 0)
+        current.offset[zone] = static_cast<uint32_t>(std::max<int64_t>(start - current.start, 0));
+    current.duration[zone] += static_cast<uint32_t>(end - start);
+}
+
+const char*
+Profiler::zoneName (ProfileZone zone)
+{
+    static const char* names[ZONE_COUNT] = { "frame", "events", "update", "draw", "text" };
+    return names[zone];
+}
+
+Profiler::Stats
+Profiler::stats (ProfileZone zone) const
+{
+    std::vector<Frame> recent = recentFrames();
+    size_t count = recent.size();
+    if (count == 0)
+        return { 0, 0, 0 };
+
+    std::vector<uint32_t> durations(count);
+    for (size_t k = 0; k < count; k++)
+        durations[k] = recent[k].duration[zone];
+    std::sort(durations.begin(), durations.end());
+
+    return {
+        durations[count / 2] / 1e6,
+        durations[std::min(count - 1, count * 99 / 100)] / 1e6,
+        durations[count - 1] / 1e6
+    };
+}
+
+void
+Profiler::writeCsv (const char* path) const
+{
+    std::ofstream out(path);
+
+    out << "frame,start_ns";
+    for (int z = 0; z < ZONE_COUNT; z++)
+        out << ',' << zoneName(static_cast<ProfileZone>(z)) << "_ns";
+    out << '\n';
+
+    for (const Frame& frame : recentFrames()) {
+        out << frame.number << ',' << frame.start;
+        for (int z = 0; z < ZONE_COUNT; z++)
+            out << ',' << frame.duration[z];
+        out << '\n';
+    }
+
+    if (!out)
+        throw std::runtime_error("Failed to write the profile");
+}
+
+void
+Profiler::writeChromeTrace (const char* path) const
+{
+    std::ofstream out(path);
+
+    // One complete event per zone and frame, microseconds. Zones entered many
+    // times in a frame (text) show as one event at the first entry.
+    out << "{\"traceEvents\":[";
+    bool first = true;
+
+    for (const Frame& frame : recentFrames()) {
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            if (frame.duration[z] == 0)
+                continue;
+
+            out << (first ? "\n" : ",\n")
+                << "{\"name\":\"" << zoneName(static_cast<ProfileZone>(z)) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+                << ",\"ts\":" << (frame.start + frame.offset[z]) / 1e3
+                << ",\"dur\":" << frame.duration[z] / 1e3 << '}';
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+
+    if (!out)
+        throw std::runtime_error("Failed to write the trace");
+}
+
+#endif /* TETRIS_PROFILE */
@@ -0,0 +1,120 @@
+#ifndef TETRIS_PROFILER_H
+#define TETRIS_PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+//
+// Frame profiler of the front end. Scoped timers add the time spent in a zone
+// to the current frame, and every finished frame goes into a ring buffer of
+// the last frames, from which the overlay reads p50/p99/max and the exports
+// write a CSV or a Chrome trace (chrome://tracing, Perfetto).
+//
+// The front end has one profiler per thread: the render thread counts a frame
+// per drawn frame, the simulation thread a frame per tick.
+// Built only with -DTETRIS_PROFILE (make profile): otherwise PROFILE_SCOPE()
+// compiles to nothing and the front end leaves the profiler out.
+//
+enum ProfileZone {
+    ZONE_FRAME,  // The whole frame, from one beginFrame() to the next
+    ZONE_EVENTS, // SDL event poll loop
+    ZONE_UPDATE, // TetrisApp::update(), a tick on the simulation thread
+    ZONE_DRAW,   // TetrisApp::draw(), present included
+    ZONE_TEXT,   // FontManager::drawText(), inside draw
+    ZONE_COUNT
+};
+
+class Profiler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int maxFrames = 1024; // Power of 2
+
+    struct Frame {
+        uint64_t number;                           // Frames counted before this one
+        int64_t  start;                            // Nanoseconds since the profiler started
+        uint32_t offset[ZONE_COUNT];               // First entry in the zone, from start
+        uint32_t duration[ZONE_COUNT];             // Total time in the zone, in nanoseconds
+    };
+
+    struct Stats {
+        double p50, p99, max; // Milliseconds
+    };
+
+private:
+    Clock::time_point epoch;
+    Frame current;
+    bool  inFrame;
+
+    // Ring buffer with a single writer, the thread running the frames. Each
+    // slot is a seqlock: its sequence is odd while the writer copies a frame
+    // in, so a reader on another thread keeps its copy only when the sequence
+    // was the same even value before and after, and skips the frame otherwise
+    // (the writer replaced it with a newer one). The frame words are relaxed
+    // atomics, so a torn copy is thrown away rather than a data race.
+    static const int frameWords = sizeof(Frame) / sizeof(uint64_t);
+
+    struct Slot {
+        std::atomic<uint64_t> sequence; // 2n + 1 while frame n is written, 2n + 2 once stored
+        std::atomic<uint64_t> words[frameWords];
+    };
+
+    std::array<Slot, maxFrames> slots;
+    std::atomic<uint64_t> head; // Frames stored
+
+    void store (const Frame& frame);
+    bool load (uint64_t number, Frame& frame) const;
+    // Copies of the frames in the buffer, oldest first
+    std::vector<Frame> recentFrames () const;
+
+public:
+    Profiler ();
+
+    int64_t now () const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+    }
+
+    // Ends the running frame, if any, and starts the next one
+    void beginFrame ();
+    void add (ProfileZone zone, int64_t start, int64_t end);
+
+    static const char* zoneName (ProfileZone zone);
+    // Percentiles of a zone over the frames in the buffer
+    Stats stats (ProfileZone zone) const;
+
+    // Throw std::runtime_error when the file cannot be written
+    void writeCsv (const char* path) const;
+    void writeChromeTrace (const char* path) const;
+};
+
+// The front end profilers, each one only written by its own thread
+extern Profiler profiler;
+extern Profiler simulationProfiler;
+
+// Adds the time until the end of the scope to a zone of the current frame
+class ScopedTimer {
+private:
+    Profiler& owner;
+    ProfileZone zone;
+    int64_t start;
+
+public:
+    ScopedTimer (Profiler& p, ProfileZone z) : owner(p), zone(z), start(p.now()) {}
+    ~ScopedTimer () { owner.add(zone, start, owner.now()); }
+};
+
+#ifdef TETRIS_PROFILE
+    #define PROFILE_CONCAT_(a, b) a##b
+    #define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+    #define PROFILE_SCOPE_ON(p, zone) ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(p, zone)
+#else
+    #define PROFILE_SCOPE_ON(p, zone) ((void) 0)
+#endif /* TETRIS_PROFILE */
+
+// Zone of the render thread profiler
+#define PROFILE_SCOPE(zone) PROFILE_SCOPE_ON(profiler, zone)
+
+#endif /* TETRIS_PROFILER_H */
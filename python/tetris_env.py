@@ -0,0 +1,168 @@
+"""
+Batch of Tetris games for training bots, over the C API of the core
+(tetris_env.h) built with `make python`.
+
+    env = TetrisEnv(1024)
+    observations = env.reset(range(1024))
+    observations, rewards, dones = env.step(actions)
+
+Results are written straight into the arrays of the environment, numpy
+arrays when numpy is installed, or into arrays the caller passes in: any
+writable C-contiguous buffer of the right item size works. A step is one tick
+of every game, actions are the Action flags of tetris.h.
+"""
+import array
+import ctypes
+import os
+import time
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+ACTION_NONE = 0
+ACTION_LEFT = 1 << 0
+ACTION_RIGHT = 1 << 1
+ACTION_ROTATE = 1 << 2
+ACTION_SOFT_DROP = 1 << 3
+ACTION_HARD_DROP = 1 << 4
+
+BLOCK_TYPES = "IOTSZJL"
+
+_library = None
+
+
+def _load(path=None):
+    global _library
+    if _library is not None:
+        return _library
+
+    # TETRIS_LIB, or the library built at the root of the repository
+    if path is None:
+        path = os.environ.get("TETRIS_LIB") or os.path.join(
+            os.path.dirname(os.path.abspath(__file__)), os.pardir, "libtetris.so")
+    lib = ctypes.CDLL(path)
+
+    p = ctypes.c_void_p
+    lib.tetrisEnvCreate.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    lib.tetrisEnvCreate.restype = p
+    lib.tetrisEnvDestroy.argtypes = [p]
+    lib.tetrisEnvCount.argtypes = [p]
+    lib.tetrisEnvObservationSize.argtypes = [p]
+    lib.tetrisEnvReset.argtypes = [p, p, p, p]
+    lib.tetrisEnvStep.argtypes = [p, p, p, p, p]
+    lib.tetrisEnvError.restype = ctypes.c_char_p
+
+    _library = lib
+    return lib
+
+
+def _address(buffer, itemsize, count, writable=True):
+    """Address of the data of a contiguous buffer of at least count items."""
+    view = memoryview(buffer)
+    if (writable and view.readonly) or not view.c_contiguous:
+        raise ValueError("Expected a writable C-contiguous buffer")
+    if view.itemsize != itemsize or view.nbytes < itemsize * count:
+        raise ValueError("Expected %d items of %d bytes" % (count, itemsize))
+    if isinstance(buffer, bytes):
+        holder = ctypes.c_char_p(buffer)
+        return ctypes.cast(holder, ctypes.c_void_p).value, holder
+    if view.readonly:
+        # ctypes only maps writable buffers, other read-only inputs are copied
+        view = memoryview(bytearray(view.cast("B")))
+    holder = (ctypes.c_char * view.nbytes).from_buffer(view.cast("B"))
+    return ctypes.addressof(holder), holder
+
+
+def _new_array(typecode, dtype, count):
+    if numpy is not None:
+        return numpy.zeros(count, dtype=dtype)
+    return array.array(typecode, bytes(count * array.array(typecode).itemsize))
+
+
+class TetrisEnv:
+    """
+    count games of cols x rows, stepped by threads threads (0 for one per
+    core). observations, rewards and dones are the arrays the results go to,
+    allocated here when not given: count x observation_size uint32, count
+    float32 and count uint8.
+    """
+
+    def __init__(self, count, cols=10, rows=20, threads=0,
+                 observations=None, rewards=None, dones=None, library=None):
+        self._lib = _load(library)
+        self._env = self._lib.tetrisEnvCreate(count, cols, rows, threads)
+        if not self._env:
+            raise RuntimeError(self._lib.tetrisEnvError().decode())
+
+        self.count = count
+        self.rows = rows
+        self.cols = cols
+        self.observation_size = self._lib.tetrisEnvObservationSize(self._env)
+
+        size = count * self.observation_size
+        self.observations = observations if observations is not None else _new_array("I", "uint32", size)
+        self.rewards = rewards if rewards is not None else _new_array("f", "float32", count)
+        self.dones = dones if dones is not None else _new_array("B", "uint8", count)
+        if numpy is not None and isinstance(self.observations, numpy.ndarray):
+            self.observations = self.observations.reshape(count, self.observation_size)
+
+        # The holders keep the buffers mapped, so the addresses stay valid
+        self._observations, observations_holder = _address(self.observations, 4, size)
+        self._rewards, rewards_holder = _address(self.rewards, 4, count)
+        self._dones, dones_holder = _address(self.dones, 1, count)
+        self._holders = [observations_holder, rewards_holder, dones_holder]
+
+    def close(self):
+        if self._env:
+            self._holders = []
+            self._lib.tetrisEnvDestroy(self._env)
+            self._env = None
+
+    def __del__(self):
+        self.close()
+
+    def _check(self, result):
+        if result != 0:
+            raise RuntimeError(self._lib.tetrisEnvError().decode())
+
+    def reset(self, seeds, mask=None):
+        """New games from seeds, only where mask is set when given. Returns the observations."""
+        if not isinstance(seeds, (bytes, bytearray, memoryview, array.array)) and not hasattr(seeds, "__array__"):
+            seeds = array.array("I", seeds)
+        seed_address, seed_holder = _address(seeds, 4, self.count, writable=False)
+        mask_address, mask_holder = (None, None) if mask is None else _address(mask, 1, self.count, writable=False)
+        # The holders must live until the call returns
+        self._check(self._lib.tetrisEnvReset(self._env, seed_address, mask_address, self._observations))
+        return self.observations
+
+    def step(self, actions):
+        """One tick of every game, returns (observations, rewards, dones)."""
+        action_address, holder = _address(actions, 1, self.count, writable=False)
+        self._check(self._lib.tetrisEnvStep(self._env, action_address, self._observations,
+                                            self._rewards, self._dones))
+        return self.observations, self.rewards, self.dones
+
+
+def _benchmark(count=4096, steps=2000):
+    env = TetrisEnv(count)
+    seeds = array.array("I", range(1, count + 1))
+    env.reset(seeds)
+    # Random keys, a fixed set cycled through so Python stays out of the timing
+    patterns = [bytes((i * 2654435761 + s * 40503) >> 13 & 0x1F for i in range(count)) for s in range(16)]
+
+    start = time.perf_counter()
+    for s in range(steps):
+        env.step(patterns[s % len(patterns)])
+        # Finished games start over, the seeds do not matter here
+        if s % 16 == 15:
+            env.reset(seeds, env.dones)
+    elapsed = time.perf_counter() - start
+
+    print("%d games, %d steps: %.0f env steps/s" % (count, steps, count * steps / elapsed))
+    env.close()
+
+
+if __name__ == "__main__":
+    _benchmark()
@@ -0,0 +1,75 @@
+#ifndef TETRIS_RANDOMIZER_H
+#define TETRIS_RANDOMIZER_H
+
+#include <cstdint>
+
+#include "block.h"
+
+//
+// SplitMix64 generator: 8 bytes of state, seeded once, a few nanoseconds per
+// number and the same sequence on every platform, so seeded games replay
+// exactly. Not suitable for anything security related.
+//
+class Random {
+private:
+    uint64_t state;
+
+public:
+    explicit Random (uint64_t seed = 0) : state(seed) {}
+
+    void seed (uint64_t s) { state = s; }
+
+    uint32_t next () {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return static_cast<uint32_t>((z ^ (z >> 31)) >> 32);
+    }
+
+    // Number in [0, n), multiply-shift instead of a division
+    int below (int n) { return static_cast<int>((static_cast<uint64_t>(next()) * n) >> 32); }
+};
+
+enum RandomizerMode {
+    RANDOMIZER_UNIFORM, // Every block is picked independently
+    RANDOMIZER_BAG,     // 7-bag: the 7 blocks are dealt in a random order, then reshuffled
+};
+
+// Draws the block types of a game
+class PieceRandomizer {
+private:
+    Random rng;
+    RandomizerMode mode;
+    uint8_t bag[BLOCKTYPE_COUNT];
+    int bagLeft;
+
+public:
+    explicit PieceRandomizer (uint64_t seed = 0, RandomizerMode m = RANDOMIZER_UNIFORM) { reset(seed, m); }
+
+    void reset (uint64_t seed, RandomizerMode m) {
+        rng.seed(seed);
+        mode = m;
+        bagLeft = 0;
+    }
+
+    RandomizerMode getMode () const { return mode; }
+
+    BlockType next () {
+        if (mode == RANDOMIZER_UNIFORM)
+            return static_cast<BlockType>(rng.below(BLOCKTYPE_COUNT));
+
+        if (bagLeft == 0) {
+            // Refill and shuffle the bag (Fisher-Yates)
+            for (int i = 0; i < BLOCKTYPE_COUNT; i++)
+                bag[i] = static_cast<uint8_t>(i);
+            for (int i = BLOCKTYPE_COUNT - 1; i > 0; i--) {
+                int j = rng.below(i + 1);
+                uint8_t t = bag[i]; bag[i] = bag[j]; bag[j] = t;
+            }
+            bagLeft = BLOCKTYPE_COUNT;
+        }
+        return static_cast<BlockType>(bag[--bagLeft]);
+    }
+};
+
+#endif /* TETRIS_RANDOMIZER_H */
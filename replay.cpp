@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "replay.h"
+
+//------------------------------------------------------------------------------------
+// Constants Definition
+//------------------------------------------------------------------------------------
+static const char replayMagic[4] = { 'T', 'T', 'R', 'P' };
+static const unsigned replayVersion = 4;
+
+//------------------------------------------------------------------------------------
+// Utils
+//------------------------------------------------------------------------------------
+void
+writeVarint (std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t
+readVarint (const std::vector<uint8_t>& in, size_t& pos)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= in.size())
+            throw std::runtime_error("Truncated data");
+
+        uint8_t byte = in[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+    throw std::runtime_error("Invalid varint");
+}
+
+//------------------------------------------------------------------------------------
+// Header
+//------------------------------------------------------------------------------------
+ReplayHeader
+ReplayHeader::fromGame (const Tetris& game)
+{
+    return { game.getSeed(), game.getConfig() };
+}
+
+Tetris
+ReplayHeader::createGame () const
+{
+    return Tetris(config, seed);
+}
+
+void
+ReplayHeader::encode (std::vector<uint8_t>& out) const
+{
+    writeVarint(out, seed);
+    writeVarint(out, config.cols);
+    writeVarint(out, config.rows);
+    writeVarint(out, config.randomizer);
+    writeVarint(out, config.previewCount);
+    writeVarint(out, config.startLevel);
+    writeVarint(out, config.linesPerLevel);
+    for (int32_t gravity : config.gravityCurve)
+        writeVarint(out, gravity);
+    writeVarint(out, config.lockDelay);
+    writeVarint(out, config.softDropDelay);
+    writeVarint(out, config.autoShiftDelay);
+    writeVarint(out, config.autoRepeatRate);
+    writeVarint(out, config.fadingTime);
+    for (int score : config.lineScores)
+        writeVarint(out, score);
+}
+
+ReplayHeader
+ReplayHeader::decode (const std::vector<uint8_t>& in, size_t& pos)
+{
+    ReplayHeader header;
+    header.seed = static_cast<uint32_t>(readVarint(in, pos));
+
+    GameConfig& config = header.config;
+    auto readInt = [&] () { return static_cast<int>(readVarint(in, pos)); };
+    config.cols = readInt();
+    config.rows = readInt();
+    config.randomizer = static_cast<RandomizerMode>(readInt());
+    config.previewCount = readInt();
+    config.startLevel = readInt();
+    config.linesPerLevel = readInt();
+    for (int32_t& gravity : config.gravityCurve)
+        gravity = readInt();
+    config.lockDelay = readInt();
+    config.softDropDelay = readInt();
+    config.autoShiftDelay = readInt();
+    config.autoRepeatRate = readInt();
+    config.fadingTime = readInt();
+    for (int& score : config.lineScores)
+        score = readInt();
+    config.validate();
+
+    return header;
+}
+
+//------------------------------------------------------------------------------------
+// Recorder
+//------------------------------------------------------------------------------------
+ReplayRecorder::ReplayRecorder (const ReplayHeader& h)
+    : header(h), ticks(0), lastChangeTick(0), lastActions(ACTION_NONE)
+{
+    // About an hour of human play before growing
+    changes.reserve(64 * 1024);
+}
+
+void
+ReplayRecorder::record (unsigned actions)
+{
+    if (actions != lastActions) {
+        writeVarint(changes, (static_cast<uint64_t>(ticks - lastChangeTick) << replayActionBits) | actions);
+        lastChangeTick = ticks;
+        lastActions = actions;
+    }
+    ticks++;
+}
+
+void
+ReplayRecorder::save (const char* path) const
+{
+    std::vector<uint8_t> data(replayMagic, replayMagic + sizeof(replayMagic));
+    writeVarint(data, replayVersion);
+    header.encode(data);
+
+    data.insert(data.end(), changes.begin(), changes.end());
+    writeVarint(data, 0);
+    writeVarint(data, ticks - lastChangeTick);
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!file)
+        throw std::runtime_error("Failed to write replay");
+}
+
+//------------------------------------------------------------------------------------
+// Player
+//------------------------------------------------------------------------------------
+ReplayPlayer::ReplayPlayer (const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Failed to open replay");
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < sizeof(replayMagic) || std::memcmp(data.data(), replayMagic, sizeof(replayMagic)))
+        throw std::runtime_error("Not a replay file");
+
+    size_t pos = sizeof(replayMagic);
+    if (readVarint(data, pos) != replayVersion)
+        throw std::runtime_error("Unsupported replay version");
+
+    header = ReplayHeader::decode(data, pos);
+
+    long tick = 0;
+    while (uint64_t change = readVarint(data, pos)) {
+        tick += static_cast<long>(change >> replayActionBits);
+        changes.push_back({ tick, static_cast<unsigned>(change & ((1u << replayActionBits) - 1)) });
+    }
+    ticks = tick + static_cast<long>(readVarint(data, pos));
+}
+
+unsigned
+ReplayPlayer::actionsAt (long tick) const
+{
+    // Last change at or before tick
+    auto next = std::upper_bound(changes.begin(), changes.end(), tick,
+                                 [] (long t, const Change& c) { return t < c.tick; });
+    return next == changes.begin() ? static_cast<unsigned>(ACTION_NONE) : (next - 1)->actions;
+}
+
+long
+ReplayPlayer::seek (Tetris& game, long tick) const
+{
+    game = header.createGame();
+
+    long end = std::min(tick, ticks);
+    unsigned actions = ACTION_NONE;
+    size_t next = 0;
+
+    for (long t = 0; t < end; t++) {
+        while (next < changes.size() && changes[next].tick == t)
+            actions = changes[next++].actions;
+        game.update(actions);
+    }
+    return end;
+}
@@ -0,0 +1,93 @@
+#ifndef TETRIS_REPLAY_H
+#define TETRIS_REPLAY_H
+
+#include <cstdint>
+#include <vector>
+
+#include "tetris.h"
+
+// Low bits of a replay change holding the actions
+static const int replayActionBits = 6;
+
+//
+// A replay is everything needed to play a game again: the game settings and
+// seed, then the actions passed to each Tetris::update() call. Since the core
+// is deterministic, running the same actions from the same seed gives the
+// same game, tick for tick.
+//
+// File layout, all numbers are LEB128 varints:
+//   "TTRP" version seed config changes...  0  trailingTicks
+// where config is the GameConfig fields in order: cols rows randomizer
+// previewCount startLevel linesPerLevel gravityCurve[0..maxLevels - 1]
+// lockDelay softDropDelay autoShiftDelay autoRepeatRate fadingTime
+// lineScores[0..4]. Replays of the fixed gravity versions 1 and 2 are
+// not supported, their gravity does not replay exactly with levels, nor
+// the ones of version 3, from before the SRS rotations.
+// Actions are only stored when they change: every change is one varint
+// (ticksSincePreviousChange << replayActionBits | actions), usually 1 or 2 bytes.
+// The changes stop at a 0 and the last actions stay held for trailingTicks.
+//
+struct ReplayHeader {
+    uint32_t seed;
+    GameConfig config;
+
+    static ReplayHeader fromGame (const Tetris& game);
+    // A new game with these settings, at its first tick
+    Tetris createGame () const;
+
+    // The seed and config varints of the layout above, also sent by netplay.
+    // decode() throws std::runtime_error on truncated data or an invalid config.
+    void encode (std::vector<uint8_t>& out) const;
+    static ReplayHeader decode (const std::vector<uint8_t>& in, size_t& pos);
+};
+
+// LEB128 varints of the replay and netplay formats, readVarint() advances pos
+// and throws std::runtime_error on truncated data
+void writeVarint (std::vector<uint8_t>& out, uint64_t value);
+uint64_t readVarint (const std::vector<uint8_t>& in, size_t& pos);
+
+class ReplayRecorder {
+private:
+    ReplayHeader header;
+    std::vector<uint8_t> changes;
+    long ticks;
+    long lastChangeTick;
+    unsigned lastActions;
+
+public:
+    explicit ReplayRecorder (const ReplayHeader& h);
+
+    // Call with the actions of every Tetris::update() call, in order
+    void record (unsigned actions);
+
+    long getTicks () const { return ticks; }
+    void save (const char* path) const;
+};
+
+class ReplayPlayer {
+private:
+    struct Change {
+        long tick;
+        unsigned actions;
+    };
+
+    ReplayHeader header;
+    std::vector<Change> changes;
+    long ticks;
+
+public:
+    // Throws std::runtime_error when the file is missing or not a valid replay
+    explicit ReplayPlayer (const char* path);
+
+    const ReplayHeader& getHeader () const { return header; }
+    long getTicks () const { return ticks; }
+
+    // Actions of update() call number tick
+    unsigned actionsAt (long tick) const;
+
+    // Restart game from the replay settings and fast-forward it to the given
+    // tick (or to the end of the replay), returns the number of ticks played
+    long seek (Tetris& game, long tick) const;
+};
+
+#endif /* TETRIS_REPLAY_H */
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "rollback.h"
+
+//------------------------------------------------------------------------------------
+// Rollback
+//------------------------------------------------------------------------------------
+RollbackSession::RollbackSession (const RollbackOptions& opts, int local)
+    : options(opts), localPlayer(local),
+      games{ Tetris(opts.config, opts.seed), Tetris(opts.config, opts.seed + 1) },
+      history(), localActions(), remoteActions(),
+      ticks(0), remoteTicks(0), mispredicted(0), checkedTicks(0), endTick(-1), resimulatedTicks(0)
+{
+    if (local != 0 && local != 1)
+        throw std::runtime_error("Unsupported player");
+    if (options.inputDelay < 0 || options.inputDelay > maxInputDelay)
+        throw std::runtime_error("Unsupported input delay");
+
+    // No local input on the first ticks of the delay
+    localTicks = options.inputDelay;
+}
+
+void
+RollbackSession::play (long tick)
+{
+    Tick& t = at(tick);
+    int remote = 1 - localPlayer;
+
+    t.states[0] = games[0].snapshot();
+    t.states[1] = games[1].snapshot();
+    t.actions[localPlayer] = localActions[tick & (historySize - 1)];
+    if (tick < remoteTicks)
+        t.actions[remote] = remoteActions[tick & (historySize - 1)];
+    else if (remoteTicks > 0) // Prediction, the remote player keeps holding the same keys
+        t.actions[remote] = remoteActions[(remoteTicks - 1) & (historySize - 1)];
+    else
+        t.actions[remote] = ACTION_NONE;
+
+    int lines[2];
+    for (int p = 0; p < 2; p++) {
+        lines[p] = games[p].getLinesCleared();
+        games[p].update(t.actions[p]);
+    }
+
+    // Attacks cancel the garbage still waiting first, then go to the opponent
+    for (int p = 0; p < 2; p++) {
+        int cleared = games[p].getLinesCleared() - lines[p];
+        if (cleared > 0)
+            games[1 - p].addGarbage(games[p].offsetGarbage(options.attackTable[cleared]));
+    }
+
+    t.over = games[0].isGameOver() || games[1].isGameOver();
+}
+
+void
+RollbackSession::advance (unsigned actions)
+{
+    resolve();
+    if (!canAdvance())
+        return;
+
+    localActions[localTicks & (historySize - 1)] = static_cast<uint8_t>(actions);
+    localTicks++;
+
+    play(ticks);
+    ticks++;
+    mispredicted = ticks;
+}
+
+void
+RollbackSession::resolve ()
+{
+    if (mispredicted < ticks) {
+        games[0].restore(at(mispredicted).states[0]);
+        games[1].restore(at(mispredicted).states[1]);
+        for (long tick = mispredicted; tick < ticks; tick++)
+            play(tick);
+
+        resimulatedTicks += ticks - mispredicted;
+        mispredicted = ticks;
+    }
+
+    // Only the ticks played with known inputs on both sides can end the game
+    long confirmed = std::min(ticks, remoteTicks);
+    for (; endTick < 0 && checkedTicks < confirmed; checkedTicks++) {
+        if (at(checkedTicks).over)
+            endTick = checkedTicks;
+    }
+
+    // The ticks played after the end only ran on predictions
+    if (endTick >= 0 && endTick + 1 < ticks) {
+        games[0].restore(at(endTick + 1).states[0]);
+        games[1].restore(at(endTick + 1).states[1]);
+        ticks = mispredicted = endTick + 1;
+    }
+}
+
+void
+RollbackSession::addRemoteActions (long tick, unsigned actions)
+{
+    if (tick != remoteTicks)
+        return;
+
+    remoteActions[tick & (historySize - 1)] = static_cast<uint8_t>(actions);
+    remoteTicks++;
+
+    if (tick < ticks && at(tick).actions[1 - localPlayer] != actions)
+        mispredicted = std::min(mispredicted, tick);
+}
+
+int
+RollbackSession::getWinner () const
+{
+    if (!isOver() || games[0].isGameOver() == games[1].isGameOver())
+        return -1;
+    return games[0].isGameOver() ? 1 : 0;
+}
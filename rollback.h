@@ -0,0 +1,99 @@
+#ifndef TETRIS_ROLLBACK_H
+#define TETRIS_ROLLBACK_H
+
+#include <cstdint>
+
+#include "tetris.h"
+
+//------------------------------------------------------------------------------------
+// Rollback
+//------------------------------------------------------------------------------------
+struct RollbackOptions {
+    uint32_t seed = 1;  // Player i plays with seed + i
+    int inputDelay = 2; // Ticks between a local input and the tick it is played on
+    int attackTable[5] = { 0, 0, 1, 2, 4 }; // Garbage rows sent for clearing 0 to 4 rows at once
+    GameConfig config;
+};
+
+//
+// Two player versus game played from inputs only. Both peers run both games,
+// and a tick is played as soon as the local input is known: the remote input
+// not received yet is predicted to be the last one received. When the real
+// input arrives and differs, both games are restored from the snapshots taken
+// before the mispredicted tick and played again up to the current one.
+// Garbage is exchanged inside the simulation, so the games stay deterministic.
+// Nothing allocates after construction: the inputs and snapshots of the last
+// historySize ticks are kept in fixed ring buffers.
+//
+class RollbackSession {
+public:
+    // Most ticks played ahead of the last remote input, the game stalls beyond
+    static const int maxRollback = 32;
+    static const int maxInputDelay = 8;
+    // Ticks of history kept, enough to resend every input the peer may miss
+    static const int historySize = 128;
+
+private:
+    struct Tick {
+        GameState states[2]; // Before the tick
+        uint8_t   actions[2];
+        bool      over;      // A game was over after the tick
+    };
+
+    RollbackOptions options;
+    int localPlayer;
+    Tetris games[2];
+
+    Tick history[historySize];
+    uint8_t localActions[historySize];
+    uint8_t remoteActions[historySize];
+    long ticks;           // Ticks played
+    long localTicks;      // Local inputs known, for ticks [0, localTicks)
+    long remoteTicks;     // Remote inputs received, for ticks [0, remoteTicks)
+    long mispredicted;    // First tick played with a wrong prediction, ticks when none
+    long checkedTicks;    // Confirmed ticks already checked for the end of the game
+    long endTick;         // Confirmed tick a game ended on, -1 while playing
+    long resimulatedTicks;
+
+    Tick& at (long tick) { return history[tick & (historySize - 1)]; }
+    void play (long tick);
+
+public:
+    static_assert((historySize & (historySize - 1)) == 0 && historySize >= 2 * (maxRollback + maxInputDelay),
+                  "The history holds every input the peers can still need");
+
+    // Throws std::runtime_error if the config or the input delay is not valid.
+    // The local player is 0 or 1.
+    RollbackSession (const RollbackOptions& opts, int local);
+
+    int getLocalPlayer () const { return localPlayer; }
+    const Tetris& getGame (int player) const { return games[player]; }
+    long getTicks () const { return ticks; }
+    long getLocalTicks () const { return localTicks; }
+    long getRemoteTicks () const { return remoteTicks; }
+    // Ticks played again after mispredictions, since the start
+    long getResimulatedTicks () const { return resimulatedTicks; }
+
+    // False when the next tick would run too far ahead of the remote inputs
+    bool canAdvance () const { return endTick < 0 && ticks - remoteTicks < maxRollback; }
+    // resolve(), then play the next tick when canAdvance(). The local actions
+    // take effect inputDelay ticks later.
+    void advance (unsigned actions);
+    // Play again the mispredicted ticks and check for the end of the game with
+    // the remote inputs received so far
+    void resolve ();
+
+    // Local actions of a tick, only valid for the last historySize local ticks
+    unsigned localActionsAt (long tick) const { return localActions[tick & (historySize - 1)]; }
+    // Remote actions of a tick, in any order and more than once: only the
+    // next missing one is kept, the others are ignored
+    void addRemoteActions (long tick, unsigned actions);
+
+    // Over once a game ended on a tick whose inputs are all known, the games
+    // are then left as they were after that tick
+    bool isOver () const { return endTick >= 0; }
+    // The confirmed winner, -1 on a draw or while playing
+    int getWinner () const;
+};
+
+#endif /* TETRIS_ROLLBACK_H */
@@ -0,0 +1,132 @@
+#include <algorithm>
+
+#include "scheduler.h"
+
+WorkStealingPool::WorkStealingPool (int threadsCount)
+    : currentTask(nullptr), generation(0), busyWorkers(0), stopping(false), failed(false)
+{
+    if (threadsCount <= 0)
+        threadsCount = std::max(1u, std::thread::hardware_concurrency());
+
+    workersN = threadsCount;
+    queues.reset(new Queue[workersN]);
+
+    // Worker 0 is the thread calling run()
+    for (int w = 1; w < workersN; w++)
+        threads.emplace_back(&WorkStealingPool::workerLoop, this, w);
+}
+
+WorkStealingPool::~WorkStealingPool ()
+{
+    {
+        std::lock_guard<std::mutex> guard(jobLock);
+        stopping = true;
+    }
+    jobReady.notify_all();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void
+WorkStealingPool::run (int count, const Task& task)
+{
+    if (count <= 0)
+        return;
+
+    // Give every worker an equal contiguous share of the tasks
+    int share = (count + workersN - 1) / workersN;
+    for (int w = 0; w < workersN; w++) {
+        std::lock_guard<std::mutex> guard(queues[w].lock);
+        queues[w].begin = std::min(count, w * share);
+        queues[w].end = std::min(count, (w + 1) * share);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(jobLock);
+        currentTask = &task;
+        busyWorkers = workersN - 1;
+        failure = nullptr;
+        failed.store(false, std::memory_order_relaxed);
+        generation++;
+    }
+    jobReady.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> guard(jobLock);
+    jobDone.wait(guard, [this] { return busyWorkers == 0; });
+    currentTask = nullptr;
+
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+bool
+WorkStealingPool::pop (int worker, int& index)
+{
+    Queue& queue = queues[worker];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.begin >= queue.end)
+        return false;
+
+    index = queue.begin++;
+    return true;
+}
+
+bool
+WorkStealingPool::steal (int worker, int& index)
+{
+    for (int k = 1; k < workersN; k++) {
+        Queue& victim = queues[(worker + k) % workersN];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.begin < victim.end) {
+            index = --victim.end;
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+WorkStealingPool::work (int worker)
+{
+    const Task& task = *currentTask;
+    int index;
+
+    // Tasks are never added during a run, so once every queue is empty this
+    // worker is done, the tasks still running belong to the other workers.
+    while (!failed.load(std::memory_order_relaxed) && (pop(worker, index) || steal(worker, index))) {
+        try {
+            task(index, worker);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> guard(jobLock);
+            if (!failure)
+                failure = std::current_exception();
+            failed.store(true, std::memory_order_relaxed);
+        }
+    }
+}
+
+void
+WorkStealingPool::workerLoop (int worker)
+{
+    unsigned long seenGeneration = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(jobLock);
+            jobReady.wait(guard, [&] { return stopping || generation != seenGeneration; });
+            if (stopping)
+                return;
+            seenGeneration = generation;
+        }
+
+        work(worker);
+
+        std::lock_guard<std::mutex> guard(jobLock);
+        if (--busyWorkers == 0)
+            jobDone.notify_one();
+    }
+}
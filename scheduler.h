@@ -0,0 +1,66 @@
+#ifndef TETRIS_SCHEDULER_H
+#define TETRIS_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Fixed pool of worker threads running batches of independent tasks.
+// Every run() splits the task indices in one contiguous range per worker.
+// A worker consumes its own range from the front, and once it is empty it
+// steals single tasks from the back of the other ranges, so a worker stuck
+// on a long task does not hold back the ones that finished early.
+// The thread calling run() works as worker 0.
+// When a task throws, the tasks not started yet are dropped, and run()
+// rethrows the first exception once every worker has stopped.
+//
+class WorkStealingPool {
+public:
+    typedef std::function<void (int index, int worker)> Task;
+
+    // 0 threads means one per hardware core
+    explicit WorkStealingPool (int threadsCount = 0);
+    ~WorkStealingPool ();
+
+    WorkStealingPool (const WorkStealingPool&) = delete;
+    WorkStealingPool& operator= (const WorkStealingPool&) = delete;
+
+    int size () const { return workersN; }
+
+    // Run task(index, worker) for every index in [0, count) and wait for all of them
+    void run (int count, const Task& task);
+
+private:
+    // Tasks left to a worker, padded to keep each one on its own cache line
+    struct Queue {
+        std::mutex lock;
+        int begin = 0, end = 0;
+        char padding[64];
+    };
+
+    int workersN;
+    std::unique_ptr<Queue[]> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex jobLock;
+    std::condition_variable jobReady, jobDone;
+    const Task* currentTask;
+    unsigned long generation;
+    int busyWorkers;
+    bool stopping;
+    std::exception_ptr failure;  // First exception of the run, under jobLock
+    std::atomic<bool>  failed;   // Set with failure, checked before each task
+
+    bool pop (int worker, int& index);
+    bool steal (int worker, int& index);
+    void work (int worker);
+    void workerLoop (int worker);
+};
+
+#endif /* TETRIS_SCHEDULER_H */
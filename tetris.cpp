@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+#include "tetris.h"
+
+//------------------------------------------------------------------------------------
+// Config
+//------------------------------------------------------------------------------------
+void
+GameConfig::validate () const
+{
+    if (cols < 4 || cols > Board::maxCols || rows < 4 || rows > Board::maxRows)
+        throw std::runtime_error("Unsupported grid size");
+    if (previewCount < 0 || previewCount > GameState::maxPreview)
+        throw std::runtime_error("Unsupported preview count");
+    if (softDropDelay < 0 || autoShiftDelay < 1 || autoRepeatRate < 0 || fadingTime < 0 || lockDelay < 0)
+        throw std::runtime_error("Unsupported speeds");
+    if (startLevel < 0 || startLevel >= maxLevels || linesPerLevel < 0)
+        throw std::runtime_error("Unsupported levels");
+    for (int32_t gravity : gravityCurve) {
+        // Falling more than the grid height in a tick would be the same as 20G
+        if (gravity < 1 || gravity > Board::maxRows * gravityUnit)
+            throw std::runtime_error("Unsupported gravity");
+    }
+}
+
+//------------------------------------------------------------------------------------
+// Tetris
+//------------------------------------------------------------------------------------
+Tetris::Tetris (const GameConfig& cfg) : Tetris(cfg, std::random_device()()) {}
+
+Tetris::Tetris (const GameConfig& cfg, uint32_t seed) : config(cfg)
+{
+    config.validate();
+
+    gameSeed = seed;
+    state.randomizer.reset(seed, config.randomizer);
+    initialize();
+}
+
+void
+Tetris::reset (uint32_t seed)
+{
+    gameSeed = seed;
+    state.randomizer.reset(seed, config.randomizer);
+    initialize();
+}
+
+uint64_t
+Tetris::hash () const
+{
+    const Block& block = state.movingBlock;
+    uint64_t position = 0;
+    if (state.hasMovingBlock) {
+        position = (static_cast<uint64_t>(block.type * 4 + block.rotation) << 16 |
+                    static_cast<uint64_t>(block.posX + 8) << 8 | static_cast<uint64_t>(block.posY + 8)) + 1;
+    }
+    for (int k = 0; k < config.previewCount; k++)
+        position = position << 3 | state.nextBlocks[(state.nextBlocksHead + k) % maxPreview];
+    position = position << 8 ^ static_cast<uint64_t>(state.pendingGarbage);
+
+    uint64_t h = (state.grid.hash() ^ (static_cast<uint64_t>(state.fadingRows) << 32) ^ position) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+void
+Tetris::restore (const GameState& snapshot)
+{
+    if (snapshot.grid.getCols() != config.cols || snapshot.grid.getRows() != config.rows)
+        throw std::runtime_error("Snapshot of another grid size");
+
+    state = snapshot;
+    state.grid.setAllDirty(); // The whole board may have changed under the front end
+}
+
+void
+Tetris::update (unsigned actions)
+{
+    // Picked once per tick, so the whole tick of the standard grid is specialized
+    if (config.cols == gridCols)
+        tick<gridCols>(actions);
+    else
+        tick<0>(actions);
+}
+
+template <int Cols>
+void
+Tetris::tick (unsigned actions)
+{
+    // Actions that were not held on the previous tick
+    unsigned pressedActions = actions & ~state.previousActions;
+    state.previousActions = actions;
+
+    if (state.gameOver)
+        return;
+
+    state.ticksCount++;
+
+    if (state.fadingRows) {
+        // Increment fading counter for fading effect
+        state.rowsFadingCounter++;
+
+        if (state.rowsFadingCounter >= config.fadingTime) {
+            removeCompletedRows();
+
+            state.rowsFadingCounter = 0;
+            state.fadingRows = 0;
+        }
+        return;
+    }
+
+    if (!state.hasMovingBlock)
+        setNewBlocks(); // Create a new moving block
+
+    if (pressedActions & ACTION_HARD_DROP) {
+        hardDrop<Cols>();
+        return;
+    }
+
+    state.gravityAccumulator += config.gravityCurve[getLevel()];
+    state.speedyGravityMovementCounter++;
+    // Left wins when both directions are held
+    int direction = (actions & ACTION_LEFT) ? -1 : ((actions & ACTION_RIGHT) ? 1 : 0);
+
+    // A new press moves the block on this same tick. Holding the direction then
+    // shifts again after the auto shift delay, and every repeat rate ticks after that.
+    if (direction == 0) {
+        state.lateralDirection = 0;
+    }
+    else if (direction != state.lateralDirection) {
+        state.lateralDirection = direction;
+        state.lateralMovementCounter = 0;
+        state.autoShifting = false;
+        solveHorizontalCollision(direction);
+    }
+    else if (++state.lateralMovementCounter >= (state.autoShifting ? config.autoRepeatRate : config.autoShiftDelay)) {
+        state.lateralMovementCounter = 0;
+        state.autoShifting = true;
+
+        if (config.autoRepeatRate == 0) {
+            // Instant repeat, slide until the block hits something
+            int previousX;
+            do {
+                previousX = state.movingBlock.posX;
+                solveHorizontalCollision(direction);
+            } while (state.movingBlock.posX != previousX);
+        }
+        else
+            solveHorizontalCollision(direction);
+    }
+
+    // Rotate once per press
+    if (pressedActions & ACTION_ROTATE)
+        solveRotationCollision();
+
+    // Whole rows fallen this tick, the fraction is kept for the next ones
+    int rows = state.gravityAccumulator >> gravityShift;
+    state.gravityAccumulator &= gravityUnit - 1;
+
+    bool softDrop = (actions & ACTION_SOFT_DROP) &&
+                    state.speedyGravityMovementCounter >= config.softDropDelay;
+    if (softDrop) {
+        // At least a row per tick, then the gravity starts over
+        rows = std::max(rows, 1);
+        state.gravityAccumulator = 0;
+    }
+
+    // A block resting on the stack locks after the lock delay, or at once
+    // when soft dropped against it. Falling again restarts the delay.
+    bool resting = solveVerticalCollision<Cols>(rows);
+    state.lockTicks = resting ? state.lockTicks + 1 : 0;
+
+    if (resting && (softDrop || state.lockTicks >= config.lockDelay))
+        addCurrentBlockToGrid<Cols>();
+}
+
+int
+Tetris::getLevel () const
+{
+    int level = config.startLevel;
+    if (config.linesPerLevel > 0)
+        level += state.linesCleared / config.linesPerLevel;
+    return std::min(level, GameConfig::maxLevels - 1);
+}
+
+void
+Tetris::initialize ()
+{
+    // Walls are written once here, the board then only changes when blocks lock
+    state.grid.reset(config.cols, config.rows);
+    state.fadingRows = 0;
+
+    // Fill the preview queue, then the first block comes from its head
+    for (int k = 0; k < maxPreview; k++)
+        state.nextBlocks[k] = static_cast<uint8_t>(state.randomizer.next());
+    state.nextBlocksHead = 0;
+    state.piecesCount = 0;
+    setNewBlocks();
+
+    state.score = 0;
+    state.linesCleared = 0;
+    state.ticksCount = 0;
+    state.gameOver = false;
+    state.previousActions = ACTION_NONE;
+    state.gravityAccumulator = 0;
+    state.lockTicks = 0;
+    state.lateralMovementCounter = 0;
+    state.lateralDirection = 0;
+    state.autoShifting = false;
+    state.rowsFadingCounter = 0;
+    state.speedyGravityMovementCounter = 0;
+    state.pendingGarbage = 0;
+    state.garbageRng.seed(~static_cast<uint64_t>(gameSeed)); // Apart from the blocks sequence
+}
+
+int
+Tetris::offsetGarbage (int rows)
+{
+    int cancelled = std::min(rows, state.pendingGarbage);
+    state.pendingGarbage -= cancelled;
+    return rows - cancelled;
+}
+
+void
+Tetris::checkCompletedRows ()
+{
+    // Only the rows of the block that just locked can have completed
+    int completedRows = 0;
+    int top = std::max(state.movingBlock.posY, 0), bottom = std::min(state.movingBlock.posY + 4, config.rows);
+    for (int i = top; i < bottom; i++) {
+        if (state.grid.isRowFull(i)) {
+            // Mark the row as FADING in the overlay, it is removed once faded out
+            state.fadingRows |= 1u << i;
+            completedRows++;
+        }
+    }
+
+    state.linesCleared += completedRows;
+    state.score += config.lineScores[completedRows];
+}
+
+void
+Tetris::removeCompletedRows ()
+{
+    state.grid.removeRows(state.fadingRows);
+}
+
+void
+Tetris::solveRotationCollision ()
+{
+    // Against a wall or the stack, the block is kicked aside rather than stuck
+    rotateBlock(state.grid, state.movingBlock);
+}
+
+void
+Tetris::solveHorizontalCollision (int direction)
+{
+    // Collision if block on left/right side is a BLOCK/WALL
+    if (direction == 0 ||
+        state.grid.collides(state.movingBlock.mask(), state.movingBlock.posX + direction, state.movingBlock.posY))
+        return;
+
+    if (direction < 0)
+        state.movingBlock.moveLeft();
+    else
+        state.movingBlock.moveRight();
+}
+
+template <int Cols>
+bool
+Tetris::solveVerticalCollision (int rows)
+{
+    // Fall up to rows at once, stopping on the first BLOCK or WALL below.
+    // Collision when the block was already resting on one.
+    Block& block = state.movingBlock;
+    int distance = state.grid.dropDistance<Cols>(block.mask(), block.posX, block.posY);
+
+    block.posY += std::min(rows, distance);
+    return distance == 0;
+}
+
+template <int Cols>
+void
+Tetris::hardDrop ()
+{
+    // Fall straight to the landing row, then lock at once
+    Block& block = state.movingBlock;
+    block.posY += state.grid.dropDistance<Cols>(block.mask(), block.posX, block.posY);
+
+    addCurrentBlockToGrid<Cols>();
+}
+
+void
+Tetris::checkGameOver ()
+{
+    if ((state.grid.row(0) | state.grid.row(1)) & state.grid.fieldMask())
+        state.gameOver = true;
+}
+
+void
+Tetris::setNewBlocks ()
+{
+    // Take the head of the preview queue, and refill its slot at the tail
+    state.movingBlock = Block(static_cast<BlockType>(state.nextBlocks[state.nextBlocksHead]));
+    state.nextBlocks[state.nextBlocksHead] = static_cast<uint8_t>(state.randomizer.next());
+    state.nextBlocksHead = (state.nextBlocksHead + 1) % maxPreview;
+    state.hasMovingBlock = true;
+
+    // Block start from x: half, y: 0
+    int squaresX = config.cols / 2 - 2;
+    state.movingBlock.setPosition(squaresX, 0);
+
+    state.speedyGravityMovementCounter = 0; // Reset the speed counter
+    state.lockTicks = 0;
+    state.piecesCount++;
+}
+
+template <int Cols>
+void
+Tetris::addCurrentBlockToGrid ()
+{
+    // Make moving block a fixed one. The board only changes here and when
+    // rows are removed, so this is also the only place where rows complete
+    // and where the stack can reach the top.
+    state.grid.place(state.movingBlock.mask(), state.movingBlock.posX, state.movingBlock.posY);
+    state.hasMovingBlock = false; // Reset moving block to start with a new one
+
+    checkCompletedRows();
+
+    if (!state.fadingRows && state.pendingGarbage > 0) {
+        int hole = 1 + state.garbageRng.below(config.cols);
+        if (state.grid.insertGarbage<Cols>(state.pendingGarbage, hole))
+            state.gameOver = true;
+        state.pendingGarbage = 0;
+    }
+    checkGameOver();
+}
+
+Block
+Tetris::getGhostBlock () const
+{
+    Block ghost = state.movingBlock;
+    ghost.posY += state.grid.dropDistance(ghost.mask(), ghost.posX, ghost.posY);
+    return ghost;
+}
+
+BlockState
+Tetris::boardCellState (int i, int j) const
+{
+    if (state.grid.isWall(i, j))
+        return WALL;
+    if (state.fadingRows & (1u << i))
+        return FADING;
+    if (state.grid.isFilled(i, j))
+        return BLOCK;
+    return EMPTY;
+}
+
+BlockState
+Tetris::cellState (int i, int j) const
+{
+    BlockState cell = boardCellState(i, j);
+    if (cell != EMPTY)
+        return cell;
+
+    if (state.hasMovingBlock) {
+        int blockI = i - state.movingBlock.posY, blockJ = j - state.movingBlock.posX;
+        if (blockI >= 0 && blockI < 4 && blockJ >= 0 && blockJ < 4 &&
+            state.movingBlock.isFilled(blockI, blockJ))
+            return MOVING;
+    }
+    return EMPTY;
+}
@@ -0,0 +1,238 @@
+#ifndef TETRIS_TETRIS_H
+#define TETRIS_TETRIS_H
+
+#include <cstdint>
+#include <type_traits>
+
+#include "block.h"
+#include "board.h"
+#include "randomizer.h"
+
+//------------------------------------------------------------------------------------
+// Constants Definition
+//------------------------------------------------------------------------------------
+// Grid sized according to google
+static const int gridCols = 10;
+static const int gridRows = 20;
+
+// All the game speeds are counted in ticks, a real time game runs this many
+// ticks per second whatever the frame rate is
+static const int ticksPerSecond = 100;
+
+//------------------------------------------------------------------------------------
+// Data
+//------------------------------------------------------------------------------------
+// Actions held during a tick. Any input source (keyboard, bot, replay) drives
+// the game by passing a combination of these flags to Tetris::update().
+enum Action {
+    ACTION_NONE      = 0,
+    ACTION_LEFT      = 1 << 0,
+    ACTION_RIGHT     = 1 << 1,
+    ACTION_ROTATE    = 1 << 2,
+    ACTION_SOFT_DROP = 1 << 3,
+    ACTION_HARD_DROP = 1 << 4,
+};
+
+//
+// Rules of a game, fixed when it starts. The defaults are the standard game,
+// research runs change the grid size (4 to Board::maxCols wide, 4 to
+// Board::maxRows high), the speeds or the scoring without recompiling.
+// All the speeds are in ticks, except gravity: cells per tick in 16.16 fixed
+// point (gravityUnit is one cell per tick), so a block can fall a fraction of
+// a row per tick or many rows at once.
+//
+static const int gravityShift = 16;
+static const int32_t gravityUnit = 1 << gravityShift;
+
+struct GameConfig {
+    static const int maxLevels = 16;
+
+    int cols = gridCols;
+    int rows = gridRows;
+    RandomizerMode randomizer = RANDOMIZER_UNIFORM;
+    int previewCount = 1;     // Upcoming blocks shown by front ends, up to GameState::maxPreview
+    int startLevel = 0;
+    int linesPerLevel = 10;   // Cleared lines to reach the next level, 0 stays on the start level
+    // Gravity of each level. Level 0 is one row every 30 ticks, then levels
+    // follow the guideline curve (0.8 - (n - 1) * 0.007)^(n - 1) seconds per row
+    // from its level 6 to 19, up to 20G on the last one.
+    int32_t gravityCurve[maxLevels] = {
+        2185, 2501, 3455, 4864, 6981, 10216, 15249, 23225,
+        36101, 57290, 92845, 153712, 260055, 449758, 795430, 20 * gravityUnit
+    };
+    int lockDelay = 30;       // Ticks a block rests on the stack before it locks, soft drop locks at once
+    int softDropDelay = 40;   // Ticks of a new block before soft drop speeds it up
+    int autoShiftDelay = 15;  // Delayed auto shift: ticks a direction is held before it repeats (DAS),
+    int autoRepeatRate = 5;   // then ticks between repeats (ARR), 0 slides the block to the wall at once
+    int fadingTime = 50;      // Ticks completed rows fade before they are removed
+    int lineScores[5] = { 0, 40, 100, 300, 1200 }; // Score of clearing 0 to 4 rows at once
+
+    // Throws std::runtime_error on rules the game cannot play
+    void validate () const;
+};
+
+//------------------------------------------------------------------------------------
+// Classes
+//------------------------------------------------------------------------------------
+//
+// The whole state of a game in progress as one plain struct, a few cache lines
+// of trivially copyable data. Search bots clone it with a plain assignment, play
+// moves from the copy and restore it afterwards.
+//
+struct GameState {
+    // Upcoming blocks kept in the preview queue
+    static const int maxPreview = 6;
+
+    // Grid, walls and locked blocks
+    Board grid;
+    uint32_t fadingRows; // Bit i set when row i is completed and fading out
+
+    // Blocks, drawn from a per-game randomizer so a seed replays the same game
+    PieceRandomizer randomizer;
+    Block movingBlock;
+    bool  hasMovingBlock;
+    // Ring buffer of the next block types, nextBlocksHead is the next one to play
+    uint8_t nextBlocks[maxPreview];
+    uint8_t nextBlocksHead;
+
+    // Game
+    bool gameOver;
+    int  score;
+    int  linesCleared;
+    int  piecesCount;
+    long ticksCount;
+    int32_t gravityAccumulator; // Fraction of row fallen, in 1/gravityUnit
+    int  lockTicks;             // Ticks the block has been resting on the stack
+    int  lateralMovementCounter;
+    int  lateralDirection; // Direction held on the previous tick, -1 left, 1 right
+    bool autoShifting;     // The held direction already passed the auto shift delay
+    int  speedyGravityMovementCounter;
+    int  rowsFadingCounter;
+    unsigned previousActions;
+
+    // Versus, garbage rows received and waiting for the next lock
+    int    pendingGarbage;
+    Random garbageRng; // Holes of the garbage rows
+};
+
+static_assert(std::is_trivially_copyable<GameState>::value, "Snapshots are plain copies");
+static_assert(sizeof(GameState) <= 6 * 64, "A snapshot fits in a few cache lines");
+
+// Rotate the block clockwise with the first SRS kick where it fits, at most
+// kickTests collision tests. False, and the block left as it was, when none fits.
+inline bool
+rotateBlock (const Board& grid, Block& block)
+{
+    uint16_t rotated = block.rotationPreview();
+    const int8_t* kickX = blockRotations.kickX[block.type][block.rotation];
+    const int8_t* kickY = blockRotations.kickY[block.type][block.rotation];
+
+    for (int k = 0; k < kickTests; k++) {
+        int x = block.posX + kickX[k], y = block.posY + kickY[k];
+        if (!grid.collides(rotated, x, y)) {
+            block.rotate();
+            block.setPosition(x, y);
+            return true;
+        }
+    }
+    return false;
+}
+
+//
+// To keep track of the current moving block and the game grid, we use
+// two different matrixes. The grid defaults to 10x20, while the matrix
+// for the moving block is a 4x4.
+// The movingBlock object keeps track of the matrix, plus the position of the block
+// in the grid (x,y). The grid is a Board bitboard holding only walls and locked
+// blocks, so collision detection is an AND between the block mask and the rows
+// it covers. The moving block and fading rows are overlays on top of the board,
+// composited only when drawing.
+//
+// The class is the pure game core: it has no SDL dependency, it advances
+// one tick per update() call from a set of held actions, and front ends read
+// its state back through the accessors below.
+//
+class Tetris {
+public:
+    static const int maxPreview = GameState::maxPreview;
+
+private:
+    // Everything that changes while playing, copied as a whole by snapshot()/restore()
+    GameState state;
+
+    // Settings
+    GameConfig config;
+    uint32_t gameSeed;
+
+    void setNewBlocks ();
+    void initialize ();
+    // The tick and the steps changing the board, Cols is the grid width for
+    // the standard grid, 0 for any width
+    template <int Cols> void tick (unsigned actions);
+    template <int Cols> void addCurrentBlockToGrid ();
+    template <int Cols> bool solveVerticalCollision (int rows);
+    template <int Cols> void hardDrop ();
+    void solveHorizontalCollision (int direction);
+    void solveRotationCollision ();
+    void checkCompletedRows ();
+    void checkGameOver ();
+    void removeCompletedRows ();
+
+public:
+    // Throw std::runtime_error if the config is not valid, a game without a
+    // seed gets a random one
+    explicit Tetris (const GameConfig& cfg = GameConfig());
+    Tetris (const GameConfig& cfg, uint32_t seed);
+
+    void update (unsigned actions);
+    // Garbage rows sent by an opponent. They rise under the stack when the next
+    // block locks without clearing rows, all with the same random hole.
+    void addGarbage (int rows) { state.pendingGarbage += rows; }
+    // Cancel pending garbage with the rows of an attack, returns the rows left to send
+    int offsetGarbage (int rows);
+    int getPendingGarbage () const { return state.pendingGarbage; }
+
+    // Restart the same game, or a new one with another seed, keeping the randomizer mode
+    void reset () { reset(gameSeed); }
+    void reset (uint32_t seed);
+
+    // Copy of the game state, and back. The settings (seed and config) are not
+    // part of it: restore() takes a snapshot of a game with the same grid size,
+    // and throws std::runtime_error otherwise.
+    const GameState& snapshot () const { return state; }
+    void restore (const GameState& snapshot);
+    // Hash of what the player sees and plays next: the board, the moving block,
+    // the preview and the garbage waiting. Games reaching the same position by
+    // different moves hash the same, the score and counters are left out.
+    uint64_t hash () const;
+
+    bool isGameOver () const { return state.gameOver; }
+    uint32_t getSeed () const { return gameSeed; }
+    const GameConfig& getConfig () const { return config; }
+    int getScore () const { return state.score; }
+    int getLinesCleared () const { return state.linesCleared; }
+    int getLevel () const;
+    int getPiecesCount () const { return state.piecesCount; }
+    long getTicksCount () const { return state.ticksCount; }
+    int getCols () const { return config.cols; }
+    int getRows () const { return config.rows; }
+    // Walls and locked blocks, without the overlays
+    const Board& getBoard () const { return state.grid; }
+    const Block* getMovingBlock () const { return state.hasMovingBlock ? &state.movingBlock : nullptr; }
+    // Where the moving block lands on a hard drop, only valid with a moving block
+    Block getGhostBlock () const;
+    // The k-th upcoming block, 0 is the next one
+    Block getNextBlock (int k = 0) const { return Block(static_cast<BlockType>(state.nextBlocks[(state.nextBlocksHead + k) % maxPreview])); }
+
+    // State of cell i, j of the grid, walls included, with the overlays composited
+    BlockState cellState (int i, int j) const;
+    // Same without the moving block: walls, locked blocks and fading rows only
+    BlockState boardCellState (int i, int j) const;
+
+    // Rows of the board (locked blocks and fading rows) changed since the last
+    // clearDirtyRows(), bit i is row i. The moving block is not tracked.
+    uint32_t getDirtyRows () const { return state.grid.getDirtyRows(); }
+    void clearDirtyRows () { state.grid.clearDirtyRows(); }
+};
+
+#endif /* TETRIS_TETRIS_H */
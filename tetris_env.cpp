@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "scheduler.h"
+#include "tetris.h"
+#include "tetris_env.h"
+
+//------------------------------------------------------------------------------------
+// Constants Definition
+//------------------------------------------------------------------------------------
+// Games stepped by one pool task, enough to make the dispatch cost negligible
+static const int gamesPerTask = 256;
+
+static const unsigned validActions = ACTION_LEFT | ACTION_RIGHT | ACTION_ROTATE | ACTION_SOFT_DROP | ACTION_HARD_DROP;
+
+//------------------------------------------------------------------------------------
+// Classes
+//------------------------------------------------------------------------------------
+struct TetrisEnv {
+    GameConfig config;
+    std::vector<Tetris> games;
+    WorkStealingPool pool;
+    int observationSize;
+
+    TetrisEnv (const GameConfig& cfg, int count, int threads)
+        : config(cfg), games(count, Tetris(cfg, 0)), pool(threads), observationSize(2 * cfg.rows + 1) {}
+
+    // Run task(first, last) over ranges of games, on the pool when there are several
+    template <typename Task>
+    void forEachRange (const Task& task) {
+        int count = static_cast<int>(games.size());
+        int tasks = (count + gamesPerTask - 1) / gamesPerTask;
+        if (tasks <= 1 || pool.size() == 1) {
+            task(0, count);
+            return;
+        }
+        pool.run(tasks, [&] (int t, int) {
+            task(t * gamesPerTask, std::min(count, (t + 1) * gamesPerTask));
+        });
+    }
+
+    void observe (const Tetris& game, uint32_t* out) const;
+};
+
+void
+TetrisEnv::observe (const Tetris& game, uint32_t* out) const
+{
+    const Board& grid = game.getBoard();
+    int rows = config.rows;
+    uint32_t field = (1u << config.cols) - 1;
+
+    // Board rows without the walls, column j + 1 moves to bit j
+    for (int i = 0; i < rows; i++)
+        out[i] = (grid.row(i) >> 1) & field;
+
+    uint32_t* moving = out + rows;
+    std::fill(moving, moving + rows, 0u);
+    uint32_t pieces = 0xF;
+
+    const Block* block = game.getMovingBlock();
+    if (block != nullptr) {
+        for (int i = 0; i < 4; i++) {
+            int y = block->posY + i;
+            if (y >= 0 && y < rows)
+                moving[y] = (Board::shapeRow(block->mask(), i, block->posX) >> 1) & field;
+        }
+        pieces = static_cast<uint32_t>(block->type);
+    }
+
+    for (int k = 0; k < config.previewCount; k++)
+        pieces |= static_cast<uint32_t>(game.getNextBlock(k).type) << (4 * (k + 1));
+    out[2 * rows] = pieces;
+}
+
+//------------------------------------------------------------------------------------
+// Utils
+//------------------------------------------------------------------------------------
+static thread_local std::string lastError;
+
+// Run f and turn its exceptions into an error result, nothing may unwind into C
+template <typename F>
+static int
+guard (const F& f)
+{
+    try {
+        f();
+        return 0;
+    }
+    catch (const std::exception& e) {
+        lastError = e.what();
+    }
+    catch (...) {
+        lastError = "Unknown error";
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------------
+// C API
+//------------------------------------------------------------------------------------
+TetrisEnv*
+tetrisEnvCreate (int count, int cols, int rows, int threads)
+{
+    TetrisEnv* env = nullptr;
+    guard([&] {
+        if (count <= 0)
+            throw std::runtime_error("The batch needs at least one game");
+
+        GameConfig config;
+        config.cols = cols;
+        config.rows = rows;
+        config.validate();
+        env = new TetrisEnv(config, count, threads);
+    });
+    return env;
+}
+
+void
+tetrisEnvDestroy (TetrisEnv* env)
+{
+    delete env;
+}
+
+int
+tetrisEnvCount (const TetrisEnv* env)
+{
+    return static_cast<int>(env->games.size());
+}
+
+int
+tetrisEnvObservationSize (const TetrisEnv* env)
+{
+    return env->observationSize;
+}
+
+int
+tetrisEnvReset (TetrisEnv* env, const uint32_t* seeds, const uint8_t* mask, uint32_t* observations)
+{
+    return guard([&] {
+        env->forEachRange([&] (int first, int last) {
+            for (int k = first; k < last; k++) {
+                if (mask == nullptr || mask[k])
+                    env->games[k].reset(seeds[k]);
+                env->observe(env->games[k], observations + static_cast<size_t>(k) * env->observationSize);
+            }
+        });
+    });
+}
+
+int
+tetrisEnvStep (TetrisEnv* env, const uint8_t* actions, uint32_t* observations, float* rewards, uint8_t* dones)
+{
+    return guard([&] {
+        env->forEachRange([&] (int first, int last) {
+            for (int k = first; k < last; k++) {
+                Tetris& game = env->games[k];
+                int score = game.getScore();
+                if (!game.isGameOver())
+                    game.update(actions[k] & validActions);
+
+                rewards[k] = static_cast<float>(game.getScore() - score);
+                dones[k] = game.isGameOver();
+                env->observe(game, observations + static_cast<size_t>(k) * env->observationSize);
+            }
+        });
+    });
+}
+
+const char*
+tetrisEnvError ()
+{
+    return lastError.c_str();
+}
@@ -0,0 +1,52 @@
+#ifndef TETRIS_ENV_H
+#define TETRIS_ENV_H
+
+#include <stdint.h>
+
+//
+// C ABI of a batch of N games of the core, for training bots from other
+// languages (python/tetris_env.py). One step is one Tetris::update() tick of
+// every game, with the actions of each one as Action flags. All arrays are
+// contiguous and owned by the caller, the results are written straight into
+// them:
+//   actions       N uint8
+//   observations  N x (2 * rows + 1) uint32, per game:
+//                   rows masks of the locked cells, bit j for column j + 1,
+//                   rows masks of the moving block,
+//                   the moving block type, then the preview ones, 4 bits each
+//                   (see BlockType, 0xF without a moving block)
+//   rewards       N float32, the score gained on the step
+//   dones         N uint8, 1 once the game is over
+// Finished games are not played anymore until they are reset, their steps
+// give a 0 reward.
+// Functions returning an int give 0 on success and -1 on failure, and the
+// ones returning a pointer give null, tetrisEnvError() then tells why.
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TetrisEnv TetrisEnv;
+
+// count games of cols x rows stepped by threads threads, 0 for one per core
+TetrisEnv* tetrisEnvCreate (int count, int cols, int rows, int threads);
+void tetrisEnvDestroy (TetrisEnv* env);
+
+int tetrisEnvCount (const TetrisEnv* env);
+// Words of one observation, 2 * rows + 1
+int tetrisEnvObservationSize (const TetrisEnv* env);
+
+// Start a new game with seeds[i] for every game i, or only for the ones with
+// mask[i] set when mask is not null. The observations of every game are written.
+int tetrisEnvReset (TetrisEnv* env, const uint32_t* seeds, const uint8_t* mask, uint32_t* observations);
+int tetrisEnvStep (TetrisEnv* env, const uint8_t* actions, uint32_t* observations, float* rewards, uint8_t* dones);
+
+// Message of the last failure on this thread
+const char* tetrisEnvError (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TETRIS_ENV_H */
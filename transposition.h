@@ -0,0 +1,68 @@
+#ifndef TETRIS_TRANSPOSITION_H
+#define TETRIS_TRANSPOSITION_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+//
+// Fixed-size table of evaluations by position hash (Board::hash(),
+// Tetris::hash()), shared by any number of search threads without a lock.
+// Every slot holds one entry, replaced by each store to it. An entry is two
+// relaxed atomic words, the value and the key XOR the value. A reader on
+// another thread may see one word of a store and one of another one, but then
+// the XOR of the two no longer matches the key, so the mixed entry reads as a
+// miss (the lockless hashing of chess engines). Keep one table per evaluation:
+// values of different weights sharing a table would be mixed up.
+//
+class TranspositionTable {
+private:
+    struct Entry {
+        std::atomic<uint64_t> check; // key ^ data
+        std::atomic<uint64_t> data;
+    };
+
+    std::unique_ptr<Entry[]> entries;
+    uint64_t mask;
+
+    // Empty entries are all zeros, key 0 would hit any of them
+    static uint64_t nonZero (uint64_t key) { return key != 0 ? key : 1; }
+
+public:
+    // 2^sizeLog2 entries of 16 bytes, allocated once
+    explicit TranspositionTable (int sizeLog2 = 16)
+        : entries(new Entry[size_t(1) << sizeLog2]()), mask((uint64_t(1) << sizeLog2) - 1) {}
+
+    TranspositionTable (const TranspositionTable&) = delete;
+    TranspositionTable& operator= (const TranspositionTable&) = delete;
+
+    // False when the key is not in the table
+    bool probe (uint64_t key, double& value) const {
+        key = nonZero(key);
+        const Entry& entry = entries[key & mask];
+        uint64_t data = entry.data.load(std::memory_order_relaxed);
+        if ((entry.check.load(std::memory_order_relaxed) ^ data) != key)
+            return false;
+        std::memcpy(&value, &data, sizeof(value));
+        return true;
+    }
+
+    void store (uint64_t key, double value) {
+        key = nonZero(key);
+        Entry& entry = entries[key & mask];
+        uint64_t data;
+        std::memcpy(&data, &value, sizeof(data));
+        entry.check.store(key ^ data, std::memory_order_relaxed);
+        entry.data.store(data, std::memory_order_relaxed);
+    }
+
+    void clear () {
+        for (uint64_t i = 0; i <= mask; i++) {
+            entries[i].check.store(0, std::memory_order_relaxed);
+            entries[i].data.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+#endif /* TETRIS_TRANSPOSITION_H */
@@ -0,0 +1,209 @@
+#include <stdexcept>
+
+#include "versus.h"
+
+//------------------------------------------------------------------------------------
+// Versus match
+//------------------------------------------------------------------------------------
+VersusMatch::VersusMatch (const VersusOptions& opts, const PlayerFactory& makeAgent)
+    : options(opts), playing(opts.players), running(0), stopping(false)
+{
+    if (options.players < 1 || options.players > maxPlayers)
+        throw std::runtime_error("Unsupported number of players");
+
+    for (int i = 0; i < options.players; i++) {
+        uint32_t seed = options.seed + i;
+        players.emplace_back(new Player(options.config, seed));
+        players[i]->agent = makeAgent(i, seed);
+        players[i]->nextTarget = (i + 1) % options.players;
+
+        // Readers get the starting state until the first tick
+        players[i]->published.writeBuffer() = players[i]->game.snapshot();
+        players[i]->published.publish();
+    }
+
+    for (int k = 0; k < options.players * options.players; k++)
+        queues.emplace_back(new GarbageQueue());
+}
+
+void
+VersusMatch::start ()
+{
+    startTime = endTime = std::chrono::steady_clock::now();
+    running.store(options.players);
+    for (int i = 0; i < options.players; i++)
+        threads.emplace_back(&VersusMatch::play, this, i);
+}
+
+void
+VersusMatch::wait ()
+{
+    if (threads.empty())
+        return;
+
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+    endTime = std::chrono::steady_clock::now();
+}
+
+void
+VersusMatch::stop ()
+{
+    stopping.store(true, std::memory_order_release);
+    wait();
+}
+
+void
+VersusMatch::setActions (int player, unsigned actions)
+{
+    Player& p = *players[player];
+    p.heldActions.store(actions, std::memory_order_relaxed);
+    p.tappedActions.fetch_or(actions, std::memory_order_relaxed);
+}
+
+const GameState&
+VersusMatch::snapshot (int player)
+{
+    TripleBuffer<GameState>& published = players[player]->published;
+    published.update();
+    return published.read();
+}
+
+void
+VersusMatch::send (int from, int rows)
+{
+    Player& sender = *players[from];
+    if (rows <= 0)
+        return;
+
+    // The next opponent still playing, then the one after it for the next attack
+    for (int k = 0; k < options.players; k++) {
+        int to = sender.nextTarget;
+        sender.nextTarget = (to + 1) % options.players;
+        if (to == from || players[to]->lost.load(std::memory_order_relaxed))
+            continue;
+
+        // Receivers drain their queues every tick, only a stopped one can fill up
+        if (queue(from, to).push({ rows }))
+            sender.garbageSent += rows;
+        return;
+    }
+}
+
+bool
+VersusMatch::isAhead (int player) const
+{
+    long ticks = players[player]->ticks.load(std::memory_order_relaxed);
+    for (int i = 0; i < options.players; i++) {
+        const Player& p = *players[i];
+        if (i != player && !p.lost.load(std::memory_order_relaxed) &&
+            p.ticks.load(std::memory_order_relaxed) + maxLead < ticks)
+            return true;
+    }
+    return false;
+}
+
+void
+VersusMatch::play (int player)
+{
+    Player& me = *players[player];
+    Tetris& game = me.game;
+
+    const auto tickDuration = std::chrono::nanoseconds(1000000000 / ticksPerSecond);
+    auto nextTick = startTime;
+
+    while (!stopping.load(std::memory_order_acquire) && !game.isGameOver() && game.getTicksCount() < options.maxTicks) {
+        // Garbage sent since the previous tick
+        Garbage garbage;
+        for (int from = 0; from < options.players; from++) {
+            while (from != player && queue(from, player).pop(garbage)) {
+                game.addGarbage(garbage.rows);
+                me.garbageReceived += garbage.rows;
+            }
+        }
+
+        unsigned actions = me.agent != nullptr ? me.agent->act(game) :
+            me.heldActions.load(std::memory_order_relaxed) | me.tappedActions.exchange(0, std::memory_order_relaxed);
+
+        int lines = game.getLinesCleared();
+        game.update(actions);
+
+        // Attacks cancel the garbage still waiting first
+        int cleared = game.getLinesCleared() - lines;
+        if (cleared > 0)
+            send(player, game.offsetGarbage(options.attackTable[cleared]));
+
+        me.published.writeBuffer() = game.snapshot();
+        me.published.publish();
+        me.ticks.store(game.getTicksCount(), std::memory_order_relaxed);
+
+        if (options.realTime) {
+            nextTick += tickDuration;
+            std::this_thread::sleep_until(nextTick);
+        }
+        else {
+            while (isAhead(player) && !stopping.load(std::memory_order_relaxed))
+                std::this_thread::yield();
+        }
+    }
+
+    // The last one standing wins, a player alone plays until it loses. The
+    // match is also over once every player ran out of ticks.
+    bool over = running.fetch_sub(1) == 1;
+    if (game.isGameOver()) {
+        me.lost.store(true, std::memory_order_relaxed);
+        over |= playing.fetch_sub(1) - 1 <= (options.players > 1 ? 1 : 0);
+    }
+    if (over)
+        stopping.store(true, std::memory_order_release);
+}
+
+VersusReport
+VersusMatch::report () const
+{
+    VersusReport report;
+    report.winner = -1;
+
+    int lostCount = 0;
+    for (int i = 0; i < options.players; i++) {
+        const Player& p = *players[i];
+        const Tetris& game = p.game;
+
+        report.players.push_back({
+            { game.getSeed(), game.getScore(), game.getLinesCleared(), game.getPiecesCount(), game.getTicksCount() },
+            p.garbageSent,
+            p.garbageReceived,
+            game.isGameOver()
+        });
+
+        if (game.isGameOver())
+            lostCount++;
+        else
+            report.winner = i;
+    }
+    if (options.players < 2 || lostCount != options.players - 1)
+        report.winner = -1;
+
+    std::chrono::duration<double> elapsed = endTime - startTime;
+    report.seconds = elapsed.count();
+    return report;
+}
+
+void
+VersusReport::print (std::ostream& out) const
+{
+    out << "player,seed,score,lines,pieces,ticks,sent,received,lost\n";
+    for (size_t i = 0; i < players.size(); i++) {
+        const VersusResult& p = players[i];
+        out << i << ',' << p.game.seed << ',' << p.game.score << ',' << p.game.lines << ','
+            << p.game.pieces << ',' << p.game.ticks << ',' << p.garbageSent << ',' << p.garbageReceived << ','
+            << p.lost << '\n';
+    }
+
+    if (winner >= 0)
+        out << "winner: player " << winner;
+    else
+        out << "draw";
+    out << ", time: " << seconds << "s" << std::endl;
+}
@@ -0,0 +1,123 @@
+#ifndef TETRIS_VERSUS_H
+#define TETRIS_VERSUS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+#include "lockfree.h"
+#include "tetris.h"
+
+//------------------------------------------------------------------------------------
+// Versus match
+//------------------------------------------------------------------------------------
+struct VersusOptions {
+    int players = 2;
+    uint32_t seed = 1;      // Player i plays with seed + i
+    long maxTicks = 100000; // The match is a draw when nobody lost after this many ticks
+    bool realTime = false;  // Tick at ticksPerSecond, otherwise as fast as possible
+    int attackTable[5] = { 0, 0, 1, 2, 4 }; // Garbage rows sent for clearing 0 to 4 rows at once
+    GameConfig config;
+};
+
+struct VersusResult {
+    GameResult game;
+    int32_t garbageSent;
+    int32_t garbageReceived;
+    bool    lost;
+};
+
+struct VersusReport {
+    std::vector<VersusResult> players;
+    int winner; // -1 on a draw
+    double seconds;
+
+    void print (std::ostream& out) const;
+};
+
+// Creates the agent of a player, a null agent plays the actions given to
+// VersusMatch::setActions() instead
+typedef std::function<std::unique_ptr<Agent> (int player, uint32_t seed)> PlayerFactory;
+
+//
+// Players of a match each run their own game on their own thread. Cleared rows
+// are sent as garbage to the next opponent still playing, round robin, through
+// one SPSC queue per pair of players, and each game publishes a snapshot after
+// every tick, so neither the tick loops nor the reader of the snapshots ever
+// take a lock. Without real time, a game waits for the others when it gets
+// maxLead ticks ahead, so a faster thread does not win by mere speed. The
+// match ends when only one player is left, or, for a single player, when
+// their game is over.
+//
+class VersusMatch {
+public:
+    static const int maxPlayers = 8;
+    // Most ticks a game runs ahead of the others when not in real time
+    static const int maxLead = 8;
+
+private:
+    struct Garbage {
+        int32_t rows;
+    };
+    typedef SpscQueue<Garbage, 64> GarbageQueue;
+
+    struct Player {
+        Player (const GameConfig& config, uint32_t seed) : game(config, seed), heldActions(0), tappedActions(0),
+            ticks(0), lost(false), nextTarget(0), garbageSent(0), garbageReceived(0) {}
+
+        Tetris game;
+        std::unique_ptr<Agent> agent;
+        std::atomic<unsigned> heldActions, tappedActions; // From setActions(), when there is no agent
+        TripleBuffer<GameState> published;
+        std::atomic<long> ticks; // Ticks played, read by the other players to stay in step
+        std::atomic<bool> lost;
+        int nextTarget;
+        int garbageSent, garbageReceived;
+    };
+
+    VersusOptions options;
+    std::vector<std::unique_ptr<Player>> players;
+    std::vector<std::unique_ptr<GarbageQueue>> queues; // From player i to j at i * players + j
+    std::vector<std::thread> threads;
+    std::atomic<int> playing; // Players who did not lose yet
+    std::atomic<int> running; // Player threads still in their tick loop
+    std::atomic<bool> stopping;
+    std::chrono::steady_clock::time_point startTime, endTime;
+
+    GarbageQueue& queue (int from, int to) { return *queues[from * options.players + to]; }
+    void send (int from, int rows);
+    bool isAhead (int player) const;
+    void play (int player);
+
+public:
+    // Throws std::runtime_error on an unsupported number of players or config
+    VersusMatch (const VersusOptions& opts, const PlayerFactory& makeAgent);
+    ~VersusMatch () { stop(); }
+
+    VersusMatch (const VersusMatch&) = delete;
+    VersusMatch& operator= (const VersusMatch&) = delete;
+
+    int getPlayers () const { return options.players; }
+
+    // Start the player threads, then wait for the end of the match, or end it now
+    void start ();
+    void wait ();
+    void stop ();
+    bool isOver () const { return stopping.load(std::memory_order_acquire); }
+
+    // Actions held by a player without agent, taps are kept until its next tick
+    void setActions (int player, unsigned actions);
+    // Latest state of a player's game, to be called from a single reader thread
+    const GameState& snapshot (int player);
+
+    // Only valid once the match is over and waited for
+    VersusReport report () const;
+};
+
+#endif /* TETRIS_VERSUS_H */